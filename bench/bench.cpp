@@ -0,0 +1,297 @@
+// 编译器性能测试
+// 用 gen 生成一组压力程序, 对每种模式 (-test, -koopa, -riscv) 运行编译器,
+// 再把 -koopa 的输出用 -riscv -koopa-in 单独编译一次, 测量只跑后端的耗时 (模式名记为 -koopa-in),
+// 读取 -time 输出的各阶段耗时, 计算吞吐量 (行/秒, MB/秒),
+// 并与保存的 baseline JSON 比较, 总耗时变慢超过阈值即视为回退 (返回 1).
+// baseline 和机器有关, 不放进仓库: 第一次运行时用 --update-baseline 生成, 没有 baseline 时也返回 1
+//
+// 用法: bench --compiler <编译器> --gen <生成器> [--work 目录] [--baseline 文件]
+//             [--update-baseline] [--reps N] [--seed N] [--scale F] [--threshold F]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BenchCase
+{
+  string name;
+  string shape;
+  int size;
+};
+
+struct Result
+{
+  string name;
+  string mode;
+  bool ok = true;
+  size_t lines = 0;
+  size_t bytes = 0;
+  double wall_ms = 0;                  // 包括进程启动和写文件
+  vector<pair<string, double>> phases; // 编译器报告的各阶段耗时, 最后一项是 total
+  double total_ms = 0;
+};
+
+static const BenchCase bench_cases[] = {
+    {"deep", "deep", 512},
+    {"wide", "wide", 4000},
+    {"decls", "decls", 4000},
+    {"items", "items", 8000},
+    {"large", "large", 2048}, // KB
+    {"calls", "calls", 2000},
+};
+// -koopa-in 要用 -koopa 的输出, 必须排在它后面
+static const char *bench_modes[] = {"-test", "-koopa", "-riscv", "-koopa-in"};
+
+static string compiler = "build/compiler";
+static string generator = "build/bench/gen";
+static string work_dir = "build/bench";
+static string baseline_file = "bench/baseline.json";
+static bool update_baseline = false;
+static int reps = 3;
+static int seed = 1;
+static double scale = 1.0;
+static double threshold = 0.10;
+
+static int Run(const string &cmd)
+{
+  int status = system(cmd.c_str());
+  return status;
+}
+
+// 读取 "[time] <阶段> <毫秒>" 格式的输出
+static vector<pair<string, double>> ReadPhaseTimes(const string &path)
+{
+  vector<pair<string, double>> phases;
+  ifstream file(path);
+  string tag, name;
+  double ms;
+  string line;
+  while (getline(file, line))
+  {
+    istringstream ss(line);
+    if (ss >> tag >> name >> ms && tag == "[time]")
+      phases.push_back({name, ms});
+  }
+  return phases;
+}
+
+static Result RunCase(const BenchCase &bench_case, const string &mode, string input)
+{
+  Result result;
+  string compile_mode = mode, options = " -time";
+  if (mode == "-koopa-in")
+  {
+    input = work_dir + "/" + bench_case.name + "-koopa.out";
+    compile_mode = "-riscv";
+    options += " -koopa-in";
+  }
+  result.name = bench_case.name;
+  result.mode = mode;
+  {
+    ifstream file(input);
+    string line;
+    while (getline(file, line))
+    {
+      result.lines++;
+      result.bytes += line.size() + 1;
+    }
+  }
+  string output = work_dir + "/" + bench_case.name + mode + ".out";
+  string time_file = work_dir + "/" + bench_case.name + mode + ".time";
+  // -test 模式把 AST 打印到 stdout
+  string cmd = compiler + " " + compile_mode + " " + input + " -o " + output + options + " > /dev/null 2> " + time_file;
+  for (int i = 0; i < reps; ++i)
+  {
+    auto start = chrono::steady_clock::now();
+    int status = Run(cmd);
+    auto end = chrono::steady_clock::now();
+    if (status != 0)
+    {
+      result.ok = false;
+      return result;
+    }
+    double wall = chrono::duration<double, milli>(end - start).count();
+    auto phases = ReadPhaseTimes(time_file);
+    // 取多次运行中每个阶段的最小值
+    if (i == 0)
+    {
+      result.wall_ms = wall;
+      result.phases = phases;
+      continue;
+    }
+    result.wall_ms = min(result.wall_ms, wall);
+    for (size_t j = 0; j < phases.size() && j < result.phases.size(); ++j)
+      result.phases[j].second = min(result.phases[j].second, phases[j].second);
+  }
+  for (auto &phase : result.phases)
+    if (phase.first == "total")
+      result.total_ms = phase.second;
+  return result;
+}
+
+static string ToJson(const vector<Result> &results)
+{
+  ostringstream out;
+  out << fixed << setprecision(3);
+  out << "{\n  \"version\": 1,\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    auto &r = results[i];
+    // 每个结果占一行, ReadBaseline 依赖这一点
+    out << "    {\"case\": \"" << r.name << "\", \"mode\": \"" << r.mode << "\", \"ok\": "
+        << (r.ok ? "true" : "false") << ", \"lines\": " << r.lines << ", \"bytes\": " << r.bytes
+        << ", \"wall_ms\": " << r.wall_ms << ", \"total_ms\": " << r.total_ms << ", \"phases\": {";
+    for (size_t j = 0; j < r.phases.size(); ++j)
+      out << (j ? ", " : "") << "\"" << r.phases[j].first << "\": " << r.phases[j].second;
+    out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+  return out.str();
+}
+
+static string JsonField(const string &line, const string &key)
+{
+  string pattern = "\"" + key + "\": ";
+  size_t pos = line.find(pattern);
+  if (pos == string::npos)
+    return "";
+  pos += pattern.size();
+  if (line[pos] == '"')
+    return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+  return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+// baseline: (case, mode) -> total_ms
+static map<pair<string, string>, double> ReadBaseline(const string &path)
+{
+  map<pair<string, string>, double> baseline;
+  ifstream file(path);
+  string line;
+  while (getline(file, line))
+  {
+    string name = JsonField(line, "case");
+    if (name.empty() || JsonField(line, "ok") != "true")
+      continue;
+    baseline[{name, JsonField(line, "mode")}] = atof(JsonField(line, "total_ms").c_str());
+  }
+  return baseline;
+}
+
+int main(int argc, const char *argv[])
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    if (arg == "--compiler" && i + 1 < argc)
+      compiler = argv[++i];
+    else if (arg == "--gen" && i + 1 < argc)
+      generator = argv[++i];
+    else if (arg == "--work" && i + 1 < argc)
+      work_dir = argv[++i];
+    else if (arg == "--baseline" && i + 1 < argc)
+      baseline_file = argv[++i];
+    else if (arg == "--update-baseline")
+      update_baseline = true;
+    else if (arg == "--reps" && i + 1 < argc)
+      reps = max(1, atoi(argv[++i]));
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = atoi(argv[++i]);
+    else if (arg == "--scale" && i + 1 < argc)
+      scale = atof(argv[++i]);
+    else if (arg == "--threshold" && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else
+    {
+      cerr << "usage: bench --compiler <path> --gen <path> [--work dir] [--baseline file]"
+           << " [--update-baseline] [--reps N] [--seed N] [--scale F] [--threshold F]" << endl;
+      return 1;
+    }
+  }
+  Run("mkdir -p " + work_dir);
+
+  vector<Result> results;
+  cout << left << setw(8) << "case" << setw(10) << "mode" << right << setw(10) << "lines"
+       << setw(12) << "total(ms)" << setw(12) << "lines/s" << setw(10) << "MB/s"
+       << "  phases(ms)" << endl;
+  cout << fixed << setprecision(2);
+  for (auto &bench_case : bench_cases)
+  {
+    int size = max(1, (int)(bench_case.size * scale));
+    string input = work_dir + "/" + bench_case.name + ".c";
+    string cmd = generator + " --shape " + bench_case.shape + " --size " + to_string(size) +
+                 " --seed " + to_string(seed) + " -o " + input;
+    if (Run(cmd) != 0)
+    {
+      cerr << "bench: failed to generate " << bench_case.name << endl;
+      return 1;
+    }
+    for (auto mode : bench_modes)
+    {
+      Result r = RunCase(bench_case, mode, input);
+      results.push_back(r);
+      cout << left << setw(8) << r.name << setw(10) << r.mode << right << setw(10) << r.lines;
+      if (!r.ok)
+      {
+        cout << setw(12) << "FAIL" << endl;
+        continue;
+      }
+      double seconds = max(r.total_ms, 1e-3) / 1000;
+      cout << setw(12) << r.total_ms << setw(12) << (size_t)(r.lines / seconds) << setw(10)
+           << r.bytes / seconds / (1024 * 1024) << "  ";
+      for (auto &phase : r.phases)
+        if (phase.first != "total")
+          cout << " " << phase.first << "=" << phase.second;
+      cout << endl;
+    }
+  }
+
+  string json = ToJson(results);
+  ofstream(work_dir + "/result.json") << json;
+  if (update_baseline)
+  {
+    ofstream(baseline_file) << json;
+    cout << "baseline saved to " << baseline_file << endl;
+    return 0;
+  }
+
+  // 没有 baseline 时无从比较, 算作失败, 免得回退检查一直悄悄通过
+  auto baseline = ReadBaseline(baseline_file);
+  if (baseline.empty())
+  {
+    cout << "no baseline at " << baseline_file << ", run with --update-baseline to save one first" << endl;
+    return 1;
+  }
+  int regressions = 0;
+  for (auto &r : results)
+  {
+    auto it = baseline.find({r.name, r.mode});
+    if (it == baseline.end())
+      continue;
+    if (!r.ok)
+    {
+      cout << "REGRESSION " << r.name << " " << r.mode << ": failed (baseline passed)" << endl;
+      regressions++;
+      continue;
+    }
+    double ratio = r.total_ms / max(it->second, 1e-3);
+    // 1ms 以内的差别当作噪声
+    if (ratio > 1 + threshold && r.total_ms - it->second > 1.0)
+    {
+      cout << "REGRESSION " << r.name << " " << r.mode << ": " << it->second << " ms -> "
+           << r.total_ms << " ms (" << (ratio - 1) * 100 << "%)" << endl;
+      regressions++;
+    }
+  }
+  if (regressions == 0)
+    cout << "no regressions against " << baseline_file << endl;
+  return regressions ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+// 压力测试用的 SysY 程序生成器
+// 用法: gen --shape <deep|wide|decls|items|large|calls> [--size N] [--seed N] [-o 文件]
+//   deep  : 深度为 N 的嵌套表达式, 左右随机嵌套
+//   wide  : 一条有 N 个操作数的长表达式
+//   decls : N 个 const/var 定义
+//   items : N 条 BlockItem (赋值语句)
+//   large : 混合以上几种, 直到文件达到 N KB
+//   calls : N 个小函数 (少数有 8 个以上参数或者比较大), main 中调用 N 次
+// 相同的 seed 总是生成相同的程序
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// std::uniform_int_distribution 在不同标准库上结果不同, 这里直接取模保证可复现
+static mt19937 rng;
+static int Rand(int n)
+{
+  return (int)(rng() % (uint32_t)n);
+}
+
+struct Generator
+{
+  ostringstream out;
+  vector<string> consts; // 已定义的常量
+  vector<string> vars;   // 已定义的变量
+  int name_count = 0;
+
+  struct Function
+  {
+    string name;
+    int params;
+    bool is_void;
+  };
+  vector<Function> funcs; // 已定义的函数
+
+  string Literal()
+  {
+    return to_string(Rand(100));
+  }
+
+  // 除数只用非零字面量, 保证生成的程序没有未定义行为
+  string Operator(bool allow_cmp)
+  {
+    static const char *ops[] = {"+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    return ops[Rand(allow_cmp ? 13 : 5)];
+  }
+
+  string Operand(const vector<string> &names)
+  {
+    if (!names.empty() && Rand(3) != 0)
+      return names[Rand((int)names.size())];
+    return Literal();
+  }
+
+  string Binary(const string &lhs, const string &op, const string &rhs)
+  {
+    if (op == "/" || op == "%")
+      return lhs + " " + op + " " + to_string(Rand(9) + 1);
+    return lhs + " " + op + " " + rhs;
+  }
+
+  // 宽表达式: a op b op c ...
+  string Wide(int n, const vector<string> &names, bool allow_cmp)
+  {
+    string exp = Operand(names);
+    for (int i = 1; i < n; ++i)
+      exp = Binary(exp, Operator(allow_cmp), Operand(names));
+    return exp;
+  }
+
+  // 深表达式: 每一层都加一对括号, 随机往左或往右嵌套
+  string Deep(int depth, const vector<string> &names)
+  {
+    string left;
+    string core = Operand(names);
+    vector<string> suffix;
+    for (int i = 0; i < depth; ++i)
+    {
+      string op = Operator(true);
+      if (op == "/" || op == "%")
+      {
+        // 除数必须是非零字面量, 只能向左嵌套
+        left += "(";
+        suffix.push_back(" " + op + " " + to_string(Rand(9) + 1) + ")");
+      }
+      else if (Rand(2))
+      {
+        left += "(";
+        suffix.push_back(" " + op + " " + Operand(names) + ")");
+      }
+      else
+      {
+        left += "(" + Operand(names) + " " + op + " ";
+        suffix.push_back(")");
+      }
+      if (Rand(4) == 0)
+        left += Rand(2) ? "-" : "!";
+    }
+    // suffix 要按嵌套的逆序闭合
+    string closing;
+    for (auto it = suffix.rbegin(); it != suffix.rend(); ++it)
+      closing += *it;
+    return left + core + closing;
+  }
+
+  string NewName(const char *prefix)
+  {
+    return prefix + to_string(name_count++);
+  }
+
+  void ConstDecl(int defs)
+  {
+    out << "  const int ";
+    for (int i = 0; i < defs; ++i)
+    {
+      string name = NewName("c");
+      out << (i ? ", " : "") << name << " = " << Wide(Rand(4) + 1, consts, false);
+      consts.push_back(name);
+    }
+    out << ";\n";
+  }
+
+  void VarDecl(int defs)
+  {
+    vector<string> names = consts;
+    names.insert(names.end(), vars.begin(), vars.end());
+    out << "  int ";
+    for (int i = 0; i < defs; ++i)
+    {
+      string name = NewName("v");
+      out << (i ? ", " : "") << name;
+      if (Rand(4) != 0)
+        out << " = " << Wide(Rand(4) + 1, names, true);
+      vars.push_back(name);
+    }
+    out << ";\n";
+  }
+
+  void Decls(int n)
+  {
+    while (n > 0)
+    {
+      int defs = min(n, Rand(4) + 1);
+      if (Rand(2))
+        ConstDecl(defs);
+      else
+        VarDecl(defs);
+      n -= defs;
+    }
+  }
+
+  void Assigns(int n)
+  {
+    if (vars.empty())
+      VarDecl(4);
+    vector<string> names = consts;
+    names.insert(names.end(), vars.begin(), vars.end());
+    for (int i = 0; i < n; ++i)
+      out << "  " << vars[Rand((int)vars.size())] << " = " << Wide(Rand(6) + 1, names, true) << ";\n";
+  }
+
+  // 调用一个已定义的有返回值的函数, 实参从 names 中选. 还没有这样的函数时用字面量
+  string Call(const vector<string> &names)
+  {
+    vector<const Function *> candidates;
+    for (auto &func : funcs)
+      if (!func.is_void)
+        candidates.push_back(&func);
+    if (candidates.empty())
+      return Literal();
+    const Function *func = candidates[Rand((int)candidates.size())];
+    string call = func->name + "(";
+    for (int i = 0; i < func->params; ++i)
+      call += (i ? ", " : "") + Operand(names);
+    return call + ")";
+  }
+
+  void Functions(int n)
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      Function func = {NewName("f"), Rand(8) == 0 ? Rand(4) + 8 : Rand(4), Rand(8) == 0};
+      vector<string> names;
+      out << (func.is_void ? "void " : "int ") << func.name << "(";
+      for (int k = 0; k < func.params; ++k)
+      {
+        names.push_back(NewName("p"));
+        out << (k ? ", " : "") << "int " << names.back();
+      }
+      out << ") {\n";
+      // 大部分函数只有一两条语句, 少数比较大, 内联时应该被代价模型挡住
+      int locals = Rand(6) == 0 ? 12 : Rand(3);
+      for (int k = 0; k < locals; ++k)
+      {
+        string name = NewName("v");
+        out << "  int " << name << " = " << Wide(Rand(4) + 1, names, true) << ";\n";
+        names.push_back(name);
+      }
+      if (func.is_void)
+        out << "  " << Call(names) << ";\n  return;\n";
+      else
+        out << "  return " << Binary(Wide(Rand(3) + 1, names, true), Operator(false), Call(names)) << ";\n";
+      out << "}\n";
+      funcs.push_back(func);
+    }
+  }
+
+  string Program(const string &shape, int size)
+  {
+    if (shape == "calls")
+      Functions(size);
+    out << "int main() {\n";
+    string ret;
+    if (shape == "deep")
+    {
+      ret = Deep(size, {});
+    }
+    else if (shape == "wide")
+    {
+      ret = Wide(size, {}, true);
+    }
+    else if (shape == "decls")
+    {
+      Decls(size);
+      ret = Wide(8, vars, true);
+    }
+    else if (shape == "items")
+    {
+      Decls(16);
+      Assigns(size);
+      ret = Wide(8, vars, true);
+    }
+    else if (shape == "large")
+    {
+      size_t limit = (size_t)size * 1024;
+      VarDecl(4);
+      Decls(32);
+      while ((size_t)out.tellp() < limit)
+      {
+        switch (Rand(4))
+        {
+        case 0:
+          Decls(8);
+          break;
+        case 1:
+          Assigns(16);
+          break;
+        case 2:
+          out << "  " << vars[Rand((int)vars.size())] << " = " << Wide(64, vars, true) << ";\n";
+          break;
+        default:
+          out << "  " << vars[Rand((int)vars.size())] << " = " << Deep(32, vars) << ";\n";
+        }
+      }
+      ret = Wide(8, vars, true);
+    }
+    else if (shape == "calls")
+    {
+      // 变量都有初值: 没初始化的局部变量读到的是之前调用留在栈上的值, 解释器和模拟器上会不一样
+      out << "  int ";
+      for (int k = 0; k < 4; ++k)
+      {
+        vars.push_back(NewName("v"));
+        out << (k ? ", " : "") << vars.back() << " = " << Literal();
+      }
+      out << ";\n";
+      const vector<string> &names = vars;
+      for (int i = 0; i < size; ++i)
+      {
+        const Function &func = funcs[Rand((int)funcs.size())];
+        if (func.is_void)
+        {
+          string call = func.name + "(";
+          for (int k = 0; k < func.params; ++k)
+            call += (k ? ", " : "") + Operand(names);
+          out << "  " << call << ");\n";
+        }
+        else
+          out << "  " << vars[Rand((int)vars.size())] << " = " << Binary(Call(names), Operator(true), Operand(names)) << ";\n";
+      }
+      ret = Wide(8, vars, false);
+    }
+    else
+    {
+      cerr << "gen: unknown shape " << shape << endl;
+      exit(1);
+    }
+    out << "  return " << ret << ";\n}\n";
+    return out.str();
+  }
+};
+
+int main(int argc, const char *argv[])
+{
+  string shape = "large", output;
+  int size = 64;
+  uint32_t seed = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    if (arg == "--shape" && i + 1 < argc)
+      shape = argv[++i];
+    else if (arg == "--size" && i + 1 < argc)
+      size = atoi(argv[++i]);
+    else if (arg == "--seed" && i + 1 < argc)
+      seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+    else if (arg == "-o" && i + 1 < argc)
+      output = argv[++i];
+    else
+    {
+      cerr << "usage: gen --shape <deep|wide|decls|items|large|calls> [--size N] [--seed N] [-o file]" << endl;
+      return 1;
+    }
+  }
+  rng.seed(seed);
+  Generator gen;
+  string program = gen.Program(shape, size);
+  if (output.empty())
+  {
+    cout << program;
+    return 0;
+  }
+  ofstream file(output);
+  file << program;
+  return file ? 0 : 1;
+}
@@ -0,0 +1,4 @@
+// ret 7
+// 基本块标签曾经是 <函数>_<基本块>, main 的入口块 main_entry 和函数 main_entry 重名
+int main_entry() { return 7; }
+int main() { return main_entry(); }
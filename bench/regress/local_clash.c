@@ -0,0 +1,5 @@
+// ret 15
+// 局部变量曾经在 IR 中叫 @<名字>_<slot>, 和函数 @x_0 重名; 参数 arg0 也不能和参数的 SSA 值重名
+int x_0() { return 3; }
+int f(int arg0, int a) { int x = arg0; { int x = a; return x_0() + x * 2; } }
+int main() { int x = 1; return f(x, 4) + x_0() + x; }
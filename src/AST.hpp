@@ -1,26 +1,46 @@
 #pragma once
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <iostream>
 #include <cassert>
+#include <functional>
+#include <vector>
+#include "SymTab.hpp"
 
-static unsigned int tmp_symbol_num = 0; // 记录临时符号 %0, %1, %2, ...
+// 这个文件和 SymTab.hpp 同时被 parser (sysy.l, sysy.y) 和 main 两个编译单元包含, 类里定义的成员函数是 inline 的,
+// 链接后两边用同一份. 它们用到的全局变量和函数也都要声明成 inline, 不能用 static, 否则每个编译单元各有一份
+
+inline unsigned int tmp_symbol_num = 0; // 记录临时符号 %0, %1, %2, ...
+inline bool ir_returned = false;        // 当前函数已经生成了 ret, 之后的语句不可达
+inline bool ir_void_func = false;       // 当前函数没有返回值
+// 生成 IR 时调用到的函数 (标识符 ID), 单独编译一个函数时 main 用它补上声明
+inline std::vector<int> ir_callees;
+// 局部值编号: 当前基本块里已经有的值, 键是规范化的 "<op> <lhs>, <rhs>" 或 "load <变量>", 值是结果.
+// 前端每个函数只生成一个基本块 (%entry), 开始生成函数时清空
+inline std::unordered_map<std::string, std::string> ir_values;
 enum class UnaryExpType
 {
   primaryT,
-  unaryT
+  unaryT,
+  callT
 };
 enum class PrimaryExpType
 {
   numberT,
-  expT
+  expT,
+  lvalT
 };
 enum class StmtExpType
 {
   lvalT,
-  returnT
+  returnT,
+  expT,  // [Exp] ";"
+  blockT
 };
-enum class DeclExpType
+enum class DeclType
 {
   constT,
   varT
@@ -30,7 +50,11 @@ class BaseAST;
 class CompUnitAST;
 class FuncDefAST;
 class FuncTypeAST;
+class FuncFParamAST;
 class BlockAST;
+class BlockItemAST;
+class DeclAST;
+class LValAST;
 class StmtAST;
 class ExpAST;
 class LOrExpAST;
@@ -42,6 +66,19 @@ class MulExpAST;
 class UnaryExpAST;
 class PrimaryExpAST;
 
+[[noreturn]] inline void SemanticError(const std::string &msg)
+{
+  std::cerr << "Error: " << msg << std::endl;
+  exit(1);
+}
+
+// 表达式子树的 Sethi-Ullman 标号
+struct ExpLabel
+{
+  int need;  // 不溢出地求值这棵子树需要的寄存器数
+  bool call; // 含有函数调用, 有副作用, 不能和别的子表达式调换求值顺序
+};
+
 // 所有 AST 的基类
 class BaseAST
 {
@@ -50,97 +87,311 @@ public:
 
   virtual void Dump() const = 0;
   virtual std::string DumpIR() const = 0; // 输出koopa IR
+  // 编译期求值 (常量表达式), 按 32 位补码回绕
+  virtual int32_t Value() const
+  {
+    SemanticError("expression is not a constant");
+  }
+  // 第一次用到时计算, 之后直接用缓存的结果
+  const ExpLabel &Label() const
+  {
+    if (label.need < 0)
+      label = ComputeLabel();
+    return label;
+  }
+
+protected:
+  // 默认是读一个变量的叶子
+  virtual ExpLabel ComputeLabel() const
+  {
+    return {1, false};
+  }
+
+private:
+  mutable ExpLabel label = {-1, false};
 };
 
-// CompUnit ::= FuncDef
+// 重复出现的语法成分 (BlockItem, ConstDef, VarDef) 在 parser 中用 vector 收集
+typedef std::vector<std::unique_ptr<BaseAST>> MulVecType;
+
+// 作为操作数的子表达式. void 函数的调用没有值, 不能出现在这些位置
+inline std::string Operand(const std::unique_ptr<BaseAST> &exp)
+{
+  std::string value = exp->DumpIR();
+  if (value.empty())
+    SemanticError("void value used in an expression");
+  return value;
+}
+
+// 生成 "%N = <op> <lhs>, <rhs>". 同一个基本块里算过同样的值时直接返回之前的结果.
+// 可交换的运算按操作数排序, gt/ge 换成 lt/le, 所以 a * b 和 b * a, a > b 和 b < a 是同一个值
+inline std::string EmitBinary(const std::string &op, const std::string &lhs, const std::string &rhs)
+{
+  std::string key_op = op, a = lhs, b = rhs;
+  if (op == "gt" || op == "ge")
+  {
+    key_op = op == "gt" ? "lt" : "le";
+    std::swap(a, b);
+  }
+  else if ((op == "add" || op == "mul" || op == "eq" || op == "ne" || op == "and" || op == "or") && b < a)
+    std::swap(a, b);
+  std::string key = key_op + " " + a + ", " + b;
+  auto it = ir_values.find(key);
+  if (it != ir_values.end())
+    return it->second;
+  std::string result = "%" + std::to_string(tmp_symbol_num++);
+  std::cout << "\t" << result << " = " << op << " " << lhs << ", " << rhs << "\n";
+  ir_values.emplace(key, result);
+  return result;
+}
+
+// 读变量. 同一个基本块里读过或写过时直接用已知的值
+inline std::string EmitLoad(const std::string &var)
+{
+  std::string key = "load " + var;
+  auto it = ir_values.find(key);
+  if (it != ir_values.end())
+    return it->second;
+  std::string result = "%" + std::to_string(tmp_symbol_num++);
+  std::cout << "\t" << result << " = load " << var << "\n";
+  ir_values.emplace(key, result);
+  return result;
+}
+
+// 局部变量在 IR 中的名字 %<标识符>_<slot>. 同名变量可能有多个 (遮蔽), 用 slot 区分;
+// 用 % 而不是 @, 这样不会和函数 (以及全局的名字) 重名
+inline std::string LocalName(const std::string &ident, int slot)
+{
+  return "%" + ident + "_" + std::to_string(slot);
+}
+
+// 写变量, 之后的读直接用写入的值. 调用的函数访问不到局部变量, 不用让它失效
+inline void EmitStore(const std::string &value, const std::string &var)
+{
+  std::cout << "\tstore " << value << ", " << var << "\n";
+  ir_values["load " + var] = value;
+}
+
+// 二元运算的标号: 两边一样重时, 先算出的一边要多占一个寄存器
+inline ExpLabel BinaryLabel(const std::unique_ptr<BaseAST> &lhs, const std::unique_ptr<BaseAST> &rhs)
+{
+  const ExpLabel &l = lhs->Label(), &r = rhs->Label();
+  return {l.need == r.need ? l.need + 1 : std::max(l.need, r.need), l.call || r.call};
+}
+
+// 生成二元运算的两个操作数. 一般从左到右; 右边更重并且两边都没有函数调用时先算右边,
+// 这样算左边时只多占一个寄存器 (右边的结果), 右递归很深的表达式也不会让临时变量越积越多
+inline void Operands(const std::unique_ptr<BaseAST> &lhs, const std::unique_ptr<BaseAST> &rhs,
+                     std::string &lvalue, std::string &rvalue)
+{
+  const ExpLabel &l = lhs->Label(), &r = rhs->Label();
+  if (r.need > l.need && !l.call && !r.call)
+  {
+    rvalue = Operand(rhs);
+    lvalue = Operand(lhs);
+    return;
+  }
+  lvalue = Operand(lhs);
+  rvalue = Operand(rhs);
+}
+
+// 边解析边编译: 设置后, parser 每解析完一个顶层的函数就交给它处理, 不再保留在 CompUnit 中,
+// 处理完这个函数的 AST 就被释放. 不设置时 (-test, -interp) parser 保留整棵 AST
+inline std::function<void(std::unique_ptr<BaseAST>)> top_level_handler;
+
+// CompUnit ::= FuncDef {FuncDef}
 class CompUnitAST : public BaseAST
 {
 public:
   // 用智能指针管理对象
-  std::unique_ptr<BaseAST> func_def;
+  MulVecType func_defs;
 
   void Dump() const override
   {
     std::cout << "CompUnitAST {";
-    func_def->Dump();
+    for (size_t i = 0; i < func_defs.size(); ++i)
+    {
+      if (i > 0)
+        std::cout << ", ";
+      func_defs[i]->Dump();
+    }
     std::cout << "}";
   }
   std::string DumpIR() const override
   {
-    return func_def->DumpIR();
+    for (auto &func_def : func_defs)
+      func_def->DumpIR();
+    return "";
   }
 };
 
-// FuncDef ::= FuncType IDENT "(" ")" Block
-class FuncDefAST : public BaseAST
+// FuncType ::= "void" | "int"
+class FuncTypeAST : public BaseAST
 {
 public:
-  std::unique_ptr<BaseAST> func_type;
-  std::string ident;
-  std::unique_ptr<BaseAST> block;
+  std::string funcT_name;
 
   void Dump() const override
   {
-    std::cout << "FuncDefAST {";
-    func_type->Dump();
-    std::cout << ", " << ident << ", ";
-    block->Dump();
+    std::cout << "FuncTypeAST {";
+    std::cout << funcT_name;
     std::cout << "}";
   }
+  std::string DumpIR() const override
+  {
+    if (funcT_name == "int")
+      std::cout << ": i32" << " ";
+    else if (funcT_name == "void")
+      std::cout << " ";
+    else
+      std::cout << "Not allowed" << std::endl;
+    return "";
+  }
+};
 
+// FuncFParam ::= BType IDENT
+class FuncFParamAST : public BaseAST
+{
+public:
+  std::unique_ptr<BaseAST> btype;
+  std::string ident;
+  int sym; // 驻留后的标识符 ID
+  void Dump() const override
+  {
+    std::cout << "FuncFParamAST {";
+    btype->Dump();
+    std::cout << ident << "}";
+  }
+  // 在参数作用域中定义, 返回复制参数用的局部变量名 (见 LocalName). 参数本身由 FuncDef 输出
   std::string DumpIR() const override
   {
-    if (ident != "main")
+    const SymbolEntry *entry = symbol_table.Define(sym, SymbolKind::varT);
+    if (!entry)
+      SemanticError("redefinition of parameter " + ident);
+    return LocalName(ident, entry->slot);
+  }
+};
+
+// Block ::= "{" {BlockItem} "}"
+class BlockAST : public BaseAST
+{
+public:
+  MulVecType block_items;
+
+  void Dump() const override
+  {
+    std::cout << "BlockAST {";
+    for (auto &block_item : block_items)
     {
-      std::cerr << "Error: only main function is supported" << std::endl;
-      exit(1);
+      block_item->Dump();
+      std::cout << ", ";
     }
-    std::cout << "fun @" << ident << "(): ";
-    func_type->DumpIR();
-    std::cout << "{" << std::endl;
-    block->DumpIR();
-    std::cout << "}" << std::endl;
+    std::cout << "}";
+  }
+  std::string DumpIR() const override
+  {
+    symbol_table.EnterScope();
+    DumpItems();
+    symbol_table.ExitScope();
     return "";
   }
+  // 不进入新的作用域, 函数体用它, 和参数共用一个作用域
+  void DumpItems() const
+  {
+    for (auto &block_item : block_items)
+    {
+      // ret 之后的语句不可达, koopa IR 的基本块也不能在 ret 之后继续
+      if (ir_returned)
+        break;
+      block_item->DumpIR();
+    }
+  }
 };
 
-// FuncType ::= "int"
-class FuncTypeAST : public BaseAST
+// FuncDef ::= FuncType IDENT "(" [FuncFParams] ")" Block
+// FuncFParams ::= FuncFParam {"," FuncFParam}
+class FuncDefAST : public BaseAST
 {
 public:
-  std::string funcT_name;
+  std::unique_ptr<BaseAST> func_type;
+  std::string ident;
+  int sym; // 驻留后的标识符 ID
+  MulVecType params;
+  std::unique_ptr<BaseAST> block;
 
   void Dump() const override
   {
-    std::cout << "FuncTypeAST {";
-    std::cout << funcT_name;
+    std::cout << "FuncDefAST {";
+    func_type->Dump();
+    std::cout << ", " << ident << ", ";
+    for (auto &param : params)
+    {
+      param->Dump();
+      std::cout << ", ";
+    }
+    block->Dump();
     std::cout << "}";
   }
+
   std::string DumpIR() const override
   {
-    if (funcT_name == "int")
-      std::cout << "i32" << " ";
-    else
-      std::cout << "Not allowed" << std::endl;
+    // 函数定义在全局作用域, 先定义再生成函数体, 这样函数体里可以递归调用自己
+    ir_void_func = static_cast<FuncTypeAST *>(func_type.get())->funcT_name == "void";
+    if (!symbol_table.Define(sym, SymbolKind::funcT, params.size(), ir_void_func ? 0 : 1))
+      SemanticError("redefinition of " + ident);
+    // 参数和函数体最外层的定义在同一个作用域
+    symbol_table.EnterScope();
+    std::cout << "fun @" << ident << "(";
+    // 参数是 SSA 值 %arg<i>, 和局部变量 (带 _<slot>) 以及临时符号 (数字) 都不会重名
+    std::vector<std::string> names;
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+      if (i > 0)
+        std::cout << ", ";
+      names.push_back(params[i]->DumpIR());
+      std::cout << "%arg" << i << ": i32";
+    }
+    std::cout << ")";
+    func_type->DumpIR();
+    std::cout << "{" << std::endl;
+    std::cout << "%entry:" << std::endl; // %e 会变蓝，\% 会变红，什么鬼？
+    // 参数是 SSA 值, 复制到栈上的变量里, 之后和普通变量一样读写
+    ir_values.clear();
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+      std::cout << "\t" << names[i] << " = alloc i32" << std::endl;
+      EmitStore("%arg" + std::to_string(i), names[i]);
+    }
+    ir_returned = false;
+    static_cast<BlockAST *>(block.get())->DumpItems();
+    // 没有 return 就走到函数末尾时返回 0 (void 函数直接返回), 保证最后一个基本块有结尾指令
+    if (!ir_returned)
+      std::cout << (ir_void_func ? "\tret" : "\tret 0") << std::endl;
+    std::cout << "}" << std::endl;
+    symbol_table.ExitScope();
     return "";
   }
 };
 
-// Block ::= "{" Stmt "}"
-class BlockAST : public BaseAST
+// BlockItem ::= Decl | Stmt
+class BlockItemAST : public BaseAST
 {
 public:
+  std::unique_ptr<BaseAST> decl;
   std::unique_ptr<BaseAST> stmt;
-
   void Dump() const override
   {
-    std::cout << "BlockAST {";
-    stmt->Dump();
+    std::cout << "BlockItemAST {";
+    if (decl != nullptr)
+      decl->Dump();
+    else
+      stmt->Dump();
     std::cout << "}";
   }
   std::string DumpIR() const override
   {
-    std::cout << "%entry:" << std::endl; // %e 会变蓝，\% 会变红，什么鬼？
+    if (decl != nullptr)
+      return decl->DumpIR();
     return stmt->DumpIR();
   }
 };
@@ -149,31 +400,29 @@ public:
 class DeclAST : public BaseAST
 {
 public:
-  DeclExpType type;
-  std::unique_ptr<BaseAST> decl;
+  DeclType type;
+  std::unique_ptr<BaseAST> const_decl;
+  std::unique_ptr<BaseAST> var_decl;
   void Dump() const override
   {
-    if (type == DeclExpType::constT)
+    if (type == DeclType::constT)
     {
-      std::cout << "const ";
+      const_decl->Dump();
     }
-    else if (type == DeclExpType::varT)
+    else if (type == DeclType::varT)
     {
-      std::cout << "var ";
+      var_decl->Dump();
     }
     else
     {
       assert(false);
     }
-    decl->Dump();
   }
   std::string DumpIR() const override
   {
-    return decl->DumpIR();
-  }
-  int32_t Value() const
-  {
-    return 0;
+    if (type == DeclType::constT)
+      return const_decl->DumpIR();
+    return var_decl->DumpIR();
   }
 };
 
@@ -230,6 +479,7 @@ class ConstDefAST : public BaseAST
 {
 public:
   std::string ident;
+  int sym; // 驻留后的标识符 ID
   std::unique_ptr<BaseAST> const_init_val;
   void Dump() const override
   {
@@ -240,7 +490,9 @@ public:
   }
   std::string DumpIR() const override
   {
-    std::cout << "\t%" << ident << " = " << const_init_val->DumpIR() << std::endl;
+    // 常量在编译期求值, 用到的地方直接换成立即数, 不生成 IR
+    if (!symbol_table.Define(sym, SymbolKind::constT, const_init_val->Value()))
+      SemanticError("redefinition of " + ident);
     return "";
   }
 };
@@ -260,22 +512,30 @@ public:
   {
     return const_exp->DumpIR();
   }
+  int32_t Value() const override
+  {
+    return const_exp->Value();
+  }
 };
 
-// ConstExp ::= AddExp
+// ConstExp ::= Exp
 class ConstExpAST : public BaseAST
 {
 public:
-  std::unique_ptr<BaseAST> add_exp;
+  std::unique_ptr<BaseAST> exp;
   void Dump() const override
   {
     std::cout << "ConstExpAST {";
-    add_exp->Dump();
+    exp->Dump();
     std::cout << "}";
   }
   std::string DumpIR() const override
   {
-    return add_exp->DumpIR();
+    return exp->DumpIR();
+  }
+  int32_t Value() const override
+  {
+    return exp->Value();
   }
 };
 
@@ -311,6 +571,7 @@ class VarDefAST : public BaseAST
 {
 public:
   std::string ident;
+  int sym; // 驻留后的标识符 ID
   std::unique_ptr<BaseAST> init_val;
   void Dump() const override
   {
@@ -325,10 +586,16 @@ public:
   }
   std::string DumpIR() const override
   {
+    // 初值中的同名标识符指的是外层的定义
+    std::string value = "";
     if (init_val != nullptr)
-    {
-      std::cout << "\t%" << ident << " = " << init_val->DumpIR() << std::endl;
-    }
+      value = Operand(init_val);
+    const SymbolEntry *entry = symbol_table.Define(sym, SymbolKind::varT);
+    if (!entry)
+      SemanticError("redefinition of " + ident);
+    std::cout << "\t" << LocalName(ident, entry->slot) << " = alloc i32" << std::endl;
+    if (init_val != nullptr)
+      EmitStore(value, LocalName(ident, entry->slot));
     return "";
   }
 };
@@ -350,24 +617,104 @@ public:
   }
 };
 
-// Stmt ::= "return" Exp ";"
+// LVal ::= IDENT
+class LValAST : public BaseAST
+{
+public:
+  std::string ident;
+  int sym; // 驻留后的标识符 ID
+  void Dump() const override
+  {
+    std::cout << "LValAST {" << ident << "}";
+  }
+  const SymbolEntry &Resolve() const
+  {
+    const SymbolEntry *entry = symbol_table.Lookup(sym);
+    if (!entry)
+      SemanticError("undefined identifier " + ident);
+    if (entry->kind == SymbolKind::funcT)
+      SemanticError(ident + " is not a variable");
+    return *entry;
+  }
+  std::string DumpIR() const override
+  {
+    const SymbolEntry &entry = Resolve();
+    if (entry.kind == SymbolKind::constT)
+      return std::to_string(entry.value);
+    return EmitLoad(LocalName(ident, entry.slot));
+  }
+  int32_t Value() const override
+  {
+    const SymbolEntry &entry = Resolve();
+    if (entry.kind != SymbolKind::constT)
+      SemanticError(ident + " is not a constant");
+    return entry.value;
+  }
+};
+
+// Stmt ::= LVal "=" Exp ";" | [Exp] ";" | Block | "return" [Exp] ";"
 class StmtAST : public BaseAST
 {
 public:
-  int ret_number;
-  std::unique_ptr<BaseAST> exp;
+  StmtExpType type; // { lvalT, returnT, expT, blockT }
+  std::unique_ptr<BaseAST> lval;
+  std::unique_ptr<BaseAST> exp; // expT 和 returnT 时可以为空
+  std::unique_ptr<BaseAST> block;
   void Dump() const override
   {
-    std::cout << "StmtAST {" << std::endl
-              << "return ";
-    exp->Dump();
+    std::cout << "StmtAST {";
+    if (type == StmtExpType::blockT)
+    {
+      block->Dump();
+      std::cout << "}";
+      return;
+    }
+    if (type == StmtExpType::lvalT)
+    {
+      lval->Dump();
+      std::cout << " = ";
+    }
+    else if (type == StmtExpType::returnT)
+      std::cout << "return ";
+    if (exp != nullptr)
+      exp->Dump();
     std::cout << "; }";
   }
   std::string DumpIR() const override
   {
-    std::string ret_value = exp->DumpIR();
-    std::cout << "\tret " << ret_value << std::endl;
-    // ret_value 是数字或者临时变量
+    if (type == StmtExpType::blockT)
+      return block->DumpIR();
+    if (type == StmtExpType::expT)
+    {
+      if (exp != nullptr)
+        exp->DumpIR();
+      return "";
+    }
+    if (type == StmtExpType::lvalT)
+    {
+      auto lval_ast = static_cast<LValAST *>(lval.get());
+      const SymbolEntry &entry = lval_ast->Resolve();
+      if (entry.kind == SymbolKind::constT)
+        SemanticError("assignment to constant " + lval_ast->ident);
+      std::string value = Operand(exp);
+      EmitStore(value, LocalName(lval_ast->ident, entry.slot));
+      return "";
+    }
+    if (exp == nullptr)
+    {
+      if (!ir_void_func)
+        SemanticError("return without a value in a function returning int");
+      std::cout << "\tret" << std::endl;
+    }
+    else
+    {
+      if (ir_void_func)
+        SemanticError("return with a value in a void function");
+      std::string ret_value = Operand(exp);
+      std::cout << "\tret " << ret_value << std::endl;
+      // ret_value 是数字或者临时变量
+    }
+    ir_returned = true;
     return "";
   }
 };
@@ -388,6 +735,16 @@ public:
   {
     return lor_exp->DumpIR();
   }
+  int32_t Value() const override
+  {
+    return lor_exp->Value();
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    return lor_exp->Label();
+  }
 };
 
 // LOrExp ::= LAndExp | LOrExp "||" LAndExp
@@ -416,14 +773,27 @@ public:
     if (op == "")
       return land_exp->DumpIR();
     assert(op == "||");
-    std::string lorexp = lor_exp->DumpIR();
-    std::string landexp = land_exp->DumpIR();
-    // TODO: Handle And operation (A && B is considered (A!=0) && (B!=0) here).
-    std::cout << "\t%" << tmp_symbol_num++ << " = eq " << lorexp << ", 0\n";
-    std::cout << "\t%" << tmp_symbol_num++ << " = eq " << landexp << ", 0\n";
-    std::cout << "\t%" << tmp_symbol_num << " = or %" << (tmp_symbol_num - 2) << ", %"
-              << (tmp_symbol_num - 1) << "\n";
-    return "%" + std::to_string(tmp_symbol_num++);
+    std::string lorexp, landexp;
+    Operands(lor_exp, land_exp, lorexp, landexp);
+    // A || B 等价于 (A!=0) | (B!=0), 暂不做短路求值
+    std::string lhs = EmitBinary("ne", lorexp, "0");
+    std::string rhs = EmitBinary("ne", landexp, "0");
+    return EmitBinary("or", lhs, rhs);
+  }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return land_exp->Value();
+    int32_t lhs = lor_exp->Value(), rhs = land_exp->Value();
+    return lhs != 0 || rhs != 0;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return land_exp->Label();
+    return BinaryLabel(lor_exp, land_exp);
   }
 };
 
@@ -462,14 +832,27 @@ public:
 
     // LAndExp := LAndExp LANDOP EqExp
     assert(op == "&&");
-    std::string landexp = land_exp->DumpIR();
-    std::string eqexp = eq_exp->DumpIR();
+    std::string landexp, eqexp;
+    Operands(land_exp, eq_exp, landexp, eqexp);
     // TODO: Handle And operation (A && B is considered (A!=0) && (B!=0) here).
-    std::cout << "\t%" << tmp_symbol_num++ << " = ne " << landexp << ", 0\n";
-    std::cout << "\t%" << tmp_symbol_num++ << " = ne " << eqexp << ", 0\n";
-    std::cout << "\t%" << tmp_symbol_num << " = and %" << (tmp_symbol_num - 2) << ", %"
-              << (tmp_symbol_num - 1) << "\n";
-    return "%" + std::to_string(tmp_symbol_num++);
+    std::string lhs = EmitBinary("ne", landexp, "0");
+    std::string rhs = EmitBinary("ne", eqexp, "0");
+    return EmitBinary("and", lhs, rhs);
+  }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return eq_exp->Value();
+    int32_t lhs = land_exp->Value(), rhs = eq_exp->Value();
+    return lhs != 0 && rhs != 0;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return eq_exp->Label();
+    return BinaryLabel(land_exp, eq_exp);
   }
 };
 
@@ -507,24 +890,31 @@ public:
     else
     {
       // EqExp := EqExp EQOP RelExp
-      std::string eqexp = eq_exp->DumpIR();
-      std::string relexp = rel_exp->DumpIR();
+      std::string eqexp, relexp;
+      Operands(eq_exp, rel_exp, eqexp, relexp);
       if (op == "==")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = eq " << eqexp << ", "
-                  << relexp << "\n";
-      }
-      else if (op == "!=")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = ne " << eqexp << ", "
-                  << relexp << "\n";
-      }
-      else
-        assert(false);
-      return "%" + std::to_string(tmp_symbol_num++);
+        return EmitBinary("eq", eqexp, relexp);
+      if (op == "!=")
+        return EmitBinary("ne", eqexp, relexp);
+      assert(false);
     }
     return "";
   }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return rel_exp->Value();
+    int32_t lhs = eq_exp->Value(), rhs = rel_exp->Value();
+    return op == "==" ? lhs == rhs : lhs != rhs;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return rel_exp->Label();
+    return BinaryLabel(eq_exp, rel_exp);
+  }
 };
 
 // RelExp ::= AddExp | RelExp "<" AddExp | RelExp ">" AddExp | RelExp "<=" AddExp | RelExp ">=" AddExp
@@ -561,34 +951,41 @@ public:
     else
     {
       // RelExp := RelExp RELOP AddExp
-      std::string relexp = rel_exp->DumpIR();
-      std::string addexp = add_exp->DumpIR();
+      std::string relexp, addexp;
+      Operands(rel_exp, add_exp, relexp, addexp);
       if (op == "<")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = lt " << relexp << ", "
-                  << addexp << "\n";
-      }
-      else if (op == ">")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = gt " << relexp << ", "
-                  << addexp << "\n";
-      }
-      else if (op == "<=")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = le " << relexp << ", "
-                  << addexp << "\n";
-      }
-      else if (op == ">=")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = ge " << relexp << ", "
-                  << addexp << "\n";
-      }
-      else
-        assert(false);
-      return "%" + std::to_string(tmp_symbol_num++);
+        return EmitBinary("lt", relexp, addexp);
+      if (op == ">")
+        return EmitBinary("gt", relexp, addexp);
+      if (op == "<=")
+        return EmitBinary("le", relexp, addexp);
+      if (op == ">=")
+        return EmitBinary("ge", relexp, addexp);
+      assert(false);
     }
     return "";
   }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return add_exp->Value();
+    int32_t lhs = rel_exp->Value(), rhs = add_exp->Value();
+    if (op == "<")
+      return lhs < rhs;
+    if (op == ">")
+      return lhs > rhs;
+    if (op == "<=")
+      return lhs <= rhs;
+    return lhs >= rhs;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return add_exp->Label();
+    return BinaryLabel(rel_exp, add_exp);
+  }
 };
 
 // AddExp ::= MulExp | AddExp "+" MulExp | AddExp "-" MulExp
@@ -625,22 +1022,31 @@ public:
     else
     {
       // AddExp := AddExp AddOp MulExp
-      std::string addexp = add_exp->DumpIR();
-      std::string mulexp = mul_exp->DumpIR();
+      std::string addexp, mulexp;
+      Operands(add_exp, mul_exp, addexp, mulexp);
       if (op == "+")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = add " << addexp << ", " << mulexp << "\n";
-      }
-      else if (op == "-")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = sub " << addexp << ", " << mulexp << "\n";
-      }
-      else
-        assert(false);
-      return "%" + std::to_string(tmp_symbol_num++);
+        return EmitBinary("add", addexp, mulexp);
+      if (op == "-")
+        return EmitBinary("sub", addexp, mulexp);
+      assert(false);
     }
     return "";
   }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return mul_exp->Value();
+    uint32_t lhs = add_exp->Value(), rhs = mul_exp->Value();
+    return op == "+" ? lhs + rhs : lhs - rhs;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return mul_exp->Label();
+    return BinaryLabel(add_exp, mul_exp);
+  }
 };
 
 // MulExp ::= UnaryExp | MulExp "*" UnaryExp | MulExp "/" UnaryExp | MulExp "%" UnaryExp
@@ -677,37 +1083,67 @@ public:
     else
     {
       // MulExp := MulExp MulOp UnaryExp
-      std::string mulexp = mul_exp->DumpIR();
-      std::string unaryexp = unary_exp->DumpIR();
+      std::string mulexp, unaryexp;
+      Operands(mul_exp, unary_exp, mulexp, unaryexp);
       if (op == "*")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = mul " << mulexp << ", " << unaryexp << "\n";
-      }
-      else if (op == "/")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = div " << mulexp << ", " << unaryexp << "\n";
-      }
-      else if (op == "%")
-      {
-        std::cout << "\t%" << tmp_symbol_num << " = mod " << mulexp << ", " << unaryexp << "\n";
-      }
-      else
-        assert(false);
-      return "%" + std::to_string(tmp_symbol_num++);
+        return EmitBinary("mul", mulexp, unaryexp);
+      if (op == "/")
+        return EmitBinary("div", mulexp, unaryexp);
+      if (op == "%")
+        return EmitBinary("mod", mulexp, unaryexp);
+      assert(false);
     }
     return "";
   }
+  int32_t Value() const override
+  {
+    if (op == "")
+      return unary_exp->Value();
+    int32_t lhs = mul_exp->Value(), rhs = unary_exp->Value();
+    if (op == "*")
+      return (uint32_t)lhs * (uint32_t)rhs;
+    if (rhs == 0)
+      SemanticError("division by zero in constant expression");
+    // INT32_MIN / -1 和 RISC-V 一样回绕
+    if (rhs == -1)
+      return op == "/" ? (int32_t)(0u - (uint32_t)lhs) : 0;
+    return op == "/" ? lhs / rhs : lhs % rhs;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (op == "")
+      return unary_exp->Label();
+    return BinaryLabel(mul_exp, unary_exp);
+  }
 };
 
-// UnaryExp ::= PrimaryExp | UnaryOp UnaryExp
+// UnaryExp ::= PrimaryExp | IDENT "(" [FuncRParams] ")" | UnaryOp UnaryExp
+// FuncRParams ::= Exp {"," Exp}
 class UnaryExpAST : public BaseAST
 {
 public:
-  UnaryExpType type; // { primaryT, unaryT }
+  UnaryExpType type; // { primaryT, unaryT, callT }
   std::string op;
   std::unique_ptr<BaseAST> exp;
+  std::string ident; // callT: 被调用的函数
+  int sym;           // callT: 驻留后的标识符 ID
+  MulVecType args;   // callT: 实参
   void Dump() const override
   {
+    if (type == UnaryExpType::callT)
+    {
+      std::cout << ident << "(";
+      for (size_t i = 0; i < args.size(); ++i)
+      {
+        if (i > 0)
+          std::cout << ", ";
+        args[i]->Dump();
+      }
+      std::cout << ")";
+      return;
+    }
     if (type == UnaryExpType::unaryT)
     {
       std::cout << op;
@@ -715,24 +1151,46 @@ public:
     }
     exp->Dump();
   }
+  // void 函数的调用返回空串
   std::string DumpIR() const override
   {
+    if (type == UnaryExpType::callT)
+    {
+      const SymbolEntry *entry = symbol_table.Lookup(sym);
+      if (!entry)
+        SemanticError("undefined function " + ident);
+      if (entry->kind != SymbolKind::funcT)
+        SemanticError(ident + " is not a function");
+      if ((size_t)entry->value != args.size())
+        SemanticError("wrong number of arguments to " + ident);
+      bool has_value = entry->slot != 0;
+      std::vector<std::string> values;
+      for (auto &arg : args)
+        values.push_back(Operand(arg));
+      ir_callees.push_back(sym);
+      std::string result = "";
+      std::cout << "\t";
+      if (has_value)
+      {
+        result = "%" + std::to_string(tmp_symbol_num++);
+        std::cout << result << " = ";
+      }
+      std::cout << "call @" << ident << "(";
+      for (size_t i = 0; i < values.size(); ++i)
+        std::cout << (i > 0 ? ", " : "") << values[i];
+      std::cout << ")" << std::endl;
+      return result;
+    }
     if (type == UnaryExpType::unaryT)
     {
-      std::string ret_value = exp->DumpIR();
-      // 当前的临时变量 tmp_symbol
-      std::string tmp_symbol = "%" + std::to_string(tmp_symbol_num);
+      std::string ret_value = Operand(exp);
       if (op == "-")
       {
-        std::cout << "  " << tmp_symbol << " = sub 0, " << ret_value << std::endl;
-        tmp_symbol_num++;
-        return tmp_symbol;
+        return EmitBinary("sub", "0", ret_value);
       }
       else if (op == "!")
       {
-        std::cout << "  " << tmp_symbol << " = eq " << ret_value << ", 0" << std::endl;
-        tmp_symbol_num++;
-        return tmp_symbol;
+        return EmitBinary("eq", ret_value, "0");
       }
       else if (op == "+")
       {
@@ -752,13 +1210,43 @@ public:
       assert(false);
     }
   }
+  int32_t Value() const override
+  {
+    if (type == UnaryExpType::callT)
+      SemanticError("function call " + ident + "() is not a constant");
+    int32_t value = exp->Value();
+    if (type == UnaryExpType::primaryT || op == "+")
+      return value;
+    if (op == "-")
+      return 0u - (uint32_t)value;
+    return value == 0;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (type == UnaryExpType::callT)
+    {
+      // 前面的实参在算后面的实参时一直占着寄存器
+      int need = 1;
+      for (size_t i = 0; i < args.size(); ++i)
+        need = std::max(need, args[i]->Label().need + (int)i);
+      return {need, true};
+    }
+    const ExpLabel &inner = exp->Label();
+    if (type == UnaryExpType::primaryT || op == "+")
+      return inner;
+    return {std::max(inner.need, 1), inner.call};
+  }
 };
 
+// PrimaryExp ::= "(" Exp ")" | LVal | Number
 class PrimaryExpAST : public BaseAST
 {
 public:
-  PrimaryExpType type; //{ numberT, expT }
+  PrimaryExpType type; //{ numberT, expT, lvalT }
   std::unique_ptr<BaseAST> exp;
+  std::unique_ptr<BaseAST> lval;
   int number;
   void Dump() const override
   {
@@ -766,6 +1254,10 @@ public:
     {
       exp->Dump();
     }
+    else if (type == PrimaryExpType::lvalT)
+    {
+      lval->Dump();
+    }
     else if (type == PrimaryExpType::numberT)
     {
       std::cout << number;
@@ -782,10 +1274,33 @@ public:
     {
       ret_value = exp->DumpIR();
     }
+    else if (type == PrimaryExpType::lvalT)
+    {
+      ret_value = lval->DumpIR();
+    }
     else if (type == PrimaryExpType::numberT)
     {
       ret_value = std::to_string(number);
     }
     return ret_value;
   }
+  int32_t Value() const override
+  {
+    if (type == PrimaryExpType::expT)
+      return exp->Value();
+    if (type == PrimaryExpType::lvalT)
+      return lval->Value();
+    return number;
+  }
+
+protected:
+  ExpLabel ComputeLabel() const override
+  {
+    if (type == PrimaryExpType::expT)
+      return exp->Label();
+    if (type == PrimaryExpType::lvalT)
+      return lval->Label();
+    // 常数是立即数, 不占寄存器
+    return {0, false};
+  }
 };
@@ -0,0 +1,663 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AST.hpp"
+#include "MappedFile.hpp"
+
+// AST 缓存
+// 把 parser 得到的 AST 存成二进制文件, 源文件没变时下次直接读回来, 不再跑 flex/bison.
+// 文件格式 (本机字节序, 所有下标都是 32 位):
+//   ASTCacheHeader
+//   uint32_t      roots[root_count]          顶层函数 (FuncDefAST) 的结点下标
+//   ASTCacheNode  nodes[node_count]          所有结点, 子结点总在父结点之前
+//   uint32_t      children[child_count]      变长的子结点列表 (BlockItem, 参数, 实参等)
+//   uint32_t      string_offsets[string_count + 1]
+//   char          chars[string_bytes]        字符串表, 相同的字符串只存一次
+// 读的时候整个文件 mmap 进来, 结点数组和字符串表原地使用, 不为每个结点分配内存;
+// 生成 IR 仍然需要 BaseAST 对象, 按顶层函数逐个重建 (和 parser 边解析边交出去一样),
+// 标识符按字符串表下标驻留, 每个字符串只驻留一次.
+// 文件头记录源文件的长度和哈希, 对不上 (或者版本不同) 时当作没有缓存
+
+const char ast_cache_magic[8] = {'S', 'Y', 'S', 'Y', 'A', 'S', 'T', '\0'};
+const uint32_t ast_cache_version = 1; // AST 的结构变了就要加一
+const uint32_t ast_cache_none = UINT32_MAX;
+
+struct ASTCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t root_count;
+  uint64_t source_size;
+  uint64_t source_hash;
+  uint32_t node_count;
+  uint32_t child_count;
+  uint32_t string_count;
+  uint32_t string_bytes;
+};
+static_assert(sizeof(ASTCacheHeader) == 48, "ASTCacheHeader layout");
+
+// 结点的类, 值写在文件里, 只能在最后追加
+enum class ASTCacheKind : uint8_t
+{
+  compUnitT,
+  funcDefT,
+  funcTypeT,
+  funcFParamT,
+  blockT,
+  blockItemT,
+  declT,
+  constDeclT,
+  bTypeT,
+  constDefT,
+  constInitValT,
+  constExpT,
+  varDeclT,
+  varDefT,
+  initValT,
+  lValT,
+  stmtT,
+  expT,
+  lOrExpT,
+  lAndExpT,
+  eqExpT,
+  relExpT,
+  addExpT,
+  mulExpT,
+  unaryExpT,
+  primaryExpT
+};
+
+// 各类的字段都放进同一个结构:
+//   str     ident, funcT_name 或 btype_name 在字符串表中的下标
+//   op      运算符的下标
+//   child   按类里声明的顺序排列的 unique_ptr 子结点
+//   list    唯一的变长子结点列表在 children 中的起点和长度
+// 没有的字段: 字符串为 -1, 子结点为 ast_cache_none
+struct ASTCacheNode
+{
+  ASTCacheKind kind;
+  uint8_t type; // DeclType, StmtExpType, UnaryExpType, PrimaryExpType
+  uint16_t reserved;
+  int32_t str;
+  int32_t op;
+  int32_t number;
+  uint32_t child[3];
+  uint32_t list;
+  uint32_t list_len;
+};
+static_assert(sizeof(ASTCacheNode) == 36, "ASTCacheNode layout");
+
+// 源文件的哈希 (FNV-1a, 64 位)
+inline uint64_t ASTCacheHash(const char *data, size_t size)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+  return hash;
+}
+
+// 边解析边记录, 最后一次写出
+class ASTCacheWriter
+{
+public:
+  // 追加一个顶层函数
+  void AddRoot(const BaseAST *func_def)
+  {
+    roots.push_back(Write(func_def));
+  }
+
+  // 先写到临时文件再改名, 中途失败不会留下不完整的缓存. 失败时返回 false
+  bool Save(const std::string &path, uint64_t source_size, uint64_t source_hash) const
+  {
+    ASTCacheHeader header;
+    memcpy(header.magic, ast_cache_magic, sizeof(header.magic));
+    header.version = ast_cache_version;
+    header.root_count = roots.size();
+    header.source_size = source_size;
+    header.source_hash = source_hash;
+    header.node_count = nodes.size();
+    header.child_count = children.size();
+    header.string_count = offsets.size() - 1;
+    header.string_bytes = chars.size();
+    std::string tmp = path + ".tmp";
+    {
+      std::ofstream file(tmp, std::ios::binary);
+      auto write = [&](const void *data, size_t size)
+      { file.write((const char *)data, size); };
+      write(&header, sizeof(header));
+      write(roots.data(), roots.size() * sizeof(uint32_t));
+      write(nodes.data(), nodes.size() * sizeof(ASTCacheNode));
+      write(children.data(), children.size() * sizeof(uint32_t));
+      write(offsets.data(), offsets.size() * sizeof(uint32_t));
+      write(chars.data(), chars.size());
+      if (!file)
+        return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+  }
+
+private:
+  std::vector<uint32_t> roots;
+  std::vector<ASTCacheNode> nodes;
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> offsets = {0};
+  std::string chars;
+  std::unordered_map<std::string, int32_t> strings;
+
+  int32_t String(const std::string &str)
+  {
+    auto it = strings.find(str);
+    if (it != strings.end())
+      return it->second;
+    int32_t id = offsets.size() - 1;
+    chars += str;
+    offsets.push_back(chars.size());
+    strings.emplace(str, id);
+    return id;
+  }
+
+  uint32_t Child(const std::unique_ptr<BaseAST> &ast)
+  {
+    return ast ? Write(ast.get()) : ast_cache_none;
+  }
+
+  // 先写完列表里每一项 (连同它们的子树), 再把下标连续地放进 children
+  void List(ASTCacheNode &node, const MulVecType &items)
+  {
+    std::vector<uint32_t> indices;
+    for (auto &item : items)
+      indices.push_back(Write(item.get()));
+    node.list = children.size();
+    node.list_len = indices.size();
+    children.insert(children.end(), indices.begin(), indices.end());
+  }
+
+  // 二元表达式: op 和左右两个子结点
+  template <typename T>
+  void Binary(ASTCacheNode &node, const T *ast, const std::unique_ptr<BaseAST> &lhs, const std::unique_ptr<BaseAST> &rhs)
+  {
+    node.op = String(ast->op);
+    node.child[0] = Child(lhs);
+    node.child[1] = Child(rhs);
+  }
+
+  // 按出现的频率排列: 表达式结点最多, 放在前面
+  uint32_t Write(const BaseAST *ast)
+  {
+    ASTCacheNode node;
+    memset(&node, 0, sizeof(node));
+    node.str = node.op = -1;
+    node.child[0] = node.child[1] = node.child[2] = ast_cache_none;
+    if (auto p = dynamic_cast<const PrimaryExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::primaryExpT;
+      node.type = (uint8_t)p->type;
+      node.number = p->number;
+      node.child[0] = Child(p->exp);
+      node.child[1] = Child(p->lval);
+    }
+    else if (auto p = dynamic_cast<const UnaryExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::unaryExpT;
+      node.type = (uint8_t)p->type;
+      node.op = String(p->op);
+      node.str = String(p->ident);
+      node.child[0] = Child(p->exp);
+      List(node, p->args);
+    }
+    else if (auto p = dynamic_cast<const MulExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::mulExpT;
+      Binary(node, p, p->mul_exp, p->unary_exp);
+    }
+    else if (auto p = dynamic_cast<const AddExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::addExpT;
+      Binary(node, p, p->add_exp, p->mul_exp);
+    }
+    else if (auto p = dynamic_cast<const RelExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::relExpT;
+      Binary(node, p, p->rel_exp, p->add_exp);
+    }
+    else if (auto p = dynamic_cast<const EqExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::eqExpT;
+      Binary(node, p, p->eq_exp, p->rel_exp);
+    }
+    else if (auto p = dynamic_cast<const LAndExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::lAndExpT;
+      Binary(node, p, p->land_exp, p->eq_exp);
+    }
+    else if (auto p = dynamic_cast<const LOrExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::lOrExpT;
+      Binary(node, p, p->lor_exp, p->land_exp);
+    }
+    else if (auto p = dynamic_cast<const ExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::expT;
+      node.child[0] = Child(p->lor_exp);
+    }
+    else if (auto p = dynamic_cast<const LValAST *>(ast))
+    {
+      node.kind = ASTCacheKind::lValT;
+      node.str = String(p->ident);
+    }
+    else if (auto p = dynamic_cast<const StmtAST *>(ast))
+    {
+      node.kind = ASTCacheKind::stmtT;
+      node.type = (uint8_t)p->type;
+      node.child[0] = Child(p->lval);
+      node.child[1] = Child(p->exp);
+      node.child[2] = Child(p->block);
+    }
+    else if (auto p = dynamic_cast<const BlockItemAST *>(ast))
+    {
+      node.kind = ASTCacheKind::blockItemT;
+      node.child[0] = Child(p->decl);
+      node.child[1] = Child(p->stmt);
+    }
+    else if (auto p = dynamic_cast<const InitValAST *>(ast))
+    {
+      node.kind = ASTCacheKind::initValT;
+      node.child[0] = Child(p->exp);
+    }
+    else if (auto p = dynamic_cast<const VarDefAST *>(ast))
+    {
+      node.kind = ASTCacheKind::varDefT;
+      node.str = String(p->ident);
+      node.child[0] = Child(p->init_val);
+    }
+    else if (auto p = dynamic_cast<const VarDeclAST *>(ast))
+    {
+      node.kind = ASTCacheKind::varDeclT;
+      node.child[0] = Child(p->btype);
+      List(node, p->var_defs);
+    }
+    else if (auto p = dynamic_cast<const DeclAST *>(ast))
+    {
+      node.kind = ASTCacheKind::declT;
+      node.type = (uint8_t)p->type;
+      node.child[0] = Child(p->const_decl);
+      node.child[1] = Child(p->var_decl);
+    }
+    else if (auto p = dynamic_cast<const ConstExpAST *>(ast))
+    {
+      node.kind = ASTCacheKind::constExpT;
+      node.child[0] = Child(p->exp);
+    }
+    else if (auto p = dynamic_cast<const ConstInitValAST *>(ast))
+    {
+      node.kind = ASTCacheKind::constInitValT;
+      node.child[0] = Child(p->const_exp);
+    }
+    else if (auto p = dynamic_cast<const ConstDefAST *>(ast))
+    {
+      node.kind = ASTCacheKind::constDefT;
+      node.str = String(p->ident);
+      node.child[0] = Child(p->const_init_val);
+    }
+    else if (auto p = dynamic_cast<const ConstDeclAST *>(ast))
+    {
+      node.kind = ASTCacheKind::constDeclT;
+      node.child[0] = Child(p->btype);
+      List(node, p->const_defs);
+    }
+    else if (auto p = dynamic_cast<const BTypeAST *>(ast))
+    {
+      node.kind = ASTCacheKind::bTypeT;
+      node.str = String(p->btype_name);
+    }
+    else if (auto p = dynamic_cast<const BlockAST *>(ast))
+    {
+      node.kind = ASTCacheKind::blockT;
+      List(node, p->block_items);
+    }
+    else if (auto p = dynamic_cast<const FuncFParamAST *>(ast))
+    {
+      node.kind = ASTCacheKind::funcFParamT;
+      node.str = String(p->ident);
+      node.child[0] = Child(p->btype);
+    }
+    else if (auto p = dynamic_cast<const FuncTypeAST *>(ast))
+    {
+      node.kind = ASTCacheKind::funcTypeT;
+      node.str = String(p->funcT_name);
+    }
+    else if (auto p = dynamic_cast<const FuncDefAST *>(ast))
+    {
+      node.kind = ASTCacheKind::funcDefT;
+      node.str = String(p->ident);
+      node.child[0] = Child(p->func_type);
+      node.child[1] = Child(p->block);
+      List(node, p->params);
+    }
+    else if (auto p = dynamic_cast<const CompUnitAST *>(ast))
+    {
+      node.kind = ASTCacheKind::compUnitT;
+      List(node, p->func_defs);
+    }
+    else
+      assert(false);
+    nodes.push_back(node);
+    return nodes.size() - 1;
+  }
+};
+
+// mmap 进来的缓存
+class ASTCache
+{
+public:
+  // 文件不存在, 格式或版本不对, 或者源文件的长度和哈希对不上时返回 false
+  bool Open(const char *path, uint64_t source_size, uint64_t source_hash)
+  {
+    if (!file.Open(path) || file.Size() < sizeof(ASTCacheHeader))
+      return false;
+    const char *data = file.Data();
+    header = (const ASTCacheHeader *)data;
+    if (memcmp(header->magic, ast_cache_magic, sizeof(header->magic)) != 0 ||
+        header->version != ast_cache_version || header->source_size != source_size ||
+        header->source_hash != source_hash)
+      return false;
+    uint64_t expected = sizeof(ASTCacheHeader) + 4ull * header->root_count +
+                        (uint64_t)sizeof(ASTCacheNode) * header->node_count + 4ull * header->child_count +
+                        4ull * (header->string_count + 1ull) + header->string_bytes;
+    if (file.Size() != expected)
+      return false;
+    roots = (const uint32_t *)(data + sizeof(ASTCacheHeader));
+    nodes = (const ASTCacheNode *)(roots + header->root_count);
+    children = (const uint32_t *)(nodes + header->node_count);
+    offsets = children + header->child_count;
+    chars = (const char *)(offsets + header->string_count + 1);
+    return Validate();
+  }
+
+  size_t RootCount() const
+  {
+    return header->root_count;
+  }
+
+  // 重建第 i 个顶层函数的 AST
+  std::unique_ptr<BaseAST> Root(size_t i)
+  {
+    return Build(roots[i]);
+  }
+
+private:
+  MappedFile file;
+  const ASTCacheHeader *header = nullptr;
+  const uint32_t *roots = nullptr;
+  const ASTCacheNode *nodes = nullptr;
+  const uint32_t *children = nullptr;
+  const uint32_t *offsets = nullptr;
+  const char *chars = nullptr;
+  std::vector<int> syms; // 字符串驻留后的标识符 ID, 还没驻留的是 -1
+
+  // 所有下标都在范围内, 子结点都在父结点之前 (所以没有环), 类和 type 都是认识的值
+  bool Validate()
+  {
+    for (uint32_t i = 0; i < header->root_count; ++i)
+      if (roots[i] >= header->node_count || nodes[roots[i]].kind != ASTCacheKind::funcDefT)
+        return false;
+    for (uint32_t i = 0; i <= header->string_count; ++i)
+      if (offsets[i] > header->string_bytes || (i > 0 && offsets[i] < offsets[i - 1]))
+        return false;
+    auto string_ok = [&](int32_t id)
+    { return id >= -1 && id < (int64_t)header->string_count; };
+    for (uint32_t i = 0; i < header->node_count; ++i)
+    {
+      const ASTCacheNode &node = nodes[i];
+      if (node.kind > ASTCacheKind::primaryExpT || node.type > 3 || !string_ok(node.str) || !string_ok(node.op))
+        return false;
+      for (uint32_t child : node.child)
+        if (child != ast_cache_none && child >= i)
+          return false;
+      if ((uint64_t)node.list + node.list_len > header->child_count)
+        return false;
+      for (uint32_t k = 0; k < node.list_len; ++k)
+        if (children[node.list + k] >= i)
+          return false;
+    }
+    syms.assign(header->string_count, -1);
+    return true;
+  }
+
+  std::string String(int32_t id) const
+  {
+    if (id < 0)
+      return "";
+    return std::string(chars + offsets[id], offsets[id + 1] - offsets[id]);
+  }
+
+  int Sym(int32_t id)
+  {
+    if (syms[id] < 0)
+      syms[id] = symbol_interner.Intern(String(id));
+    return syms[id];
+  }
+
+  std::unique_ptr<BaseAST> Child(const ASTCacheNode &node, int k)
+  {
+    return node.child[k] == ast_cache_none ? nullptr : Build(node.child[k]);
+  }
+
+  void List(const ASTCacheNode &node, MulVecType &items)
+  {
+    for (uint32_t k = 0; k < node.list_len; ++k)
+      items.push_back(Build(children[node.list + k]));
+  }
+
+  std::unique_ptr<BaseAST> Build(uint32_t index)
+  {
+    const ASTCacheNode &node = nodes[index];
+    switch (node.kind)
+    {
+    case ASTCacheKind::compUnitT:
+    {
+      auto ast = std::make_unique<CompUnitAST>();
+      List(node, ast->func_defs);
+      return ast;
+    }
+    case ASTCacheKind::funcDefT:
+    {
+      auto ast = std::make_unique<FuncDefAST>();
+      ast->ident = String(node.str);
+      ast->sym = Sym(node.str);
+      ast->func_type = Child(node, 0);
+      ast->block = Child(node, 1);
+      List(node, ast->params);
+      return ast;
+    }
+    case ASTCacheKind::funcTypeT:
+    {
+      auto ast = std::make_unique<FuncTypeAST>();
+      ast->funcT_name = String(node.str);
+      return ast;
+    }
+    case ASTCacheKind::funcFParamT:
+    {
+      auto ast = std::make_unique<FuncFParamAST>();
+      ast->ident = String(node.str);
+      ast->sym = Sym(node.str);
+      ast->btype = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::blockT:
+    {
+      auto ast = std::make_unique<BlockAST>();
+      List(node, ast->block_items);
+      return ast;
+    }
+    case ASTCacheKind::blockItemT:
+    {
+      auto ast = std::make_unique<BlockItemAST>();
+      ast->decl = Child(node, 0);
+      ast->stmt = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::declT:
+    {
+      auto ast = std::make_unique<DeclAST>();
+      ast->type = (DeclType)node.type;
+      ast->const_decl = Child(node, 0);
+      ast->var_decl = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::constDeclT:
+    {
+      auto ast = std::make_unique<ConstDeclAST>();
+      ast->btype = Child(node, 0);
+      List(node, ast->const_defs);
+      return ast;
+    }
+    case ASTCacheKind::bTypeT:
+    {
+      auto ast = std::make_unique<BTypeAST>();
+      ast->btype_name = String(node.str);
+      return ast;
+    }
+    case ASTCacheKind::constDefT:
+    {
+      auto ast = std::make_unique<ConstDefAST>();
+      ast->ident = String(node.str);
+      ast->sym = Sym(node.str);
+      ast->const_init_val = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::constInitValT:
+    {
+      auto ast = std::make_unique<ConstInitValAST>();
+      ast->const_exp = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::constExpT:
+    {
+      auto ast = std::make_unique<ConstExpAST>();
+      ast->exp = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::varDeclT:
+    {
+      auto ast = std::make_unique<VarDeclAST>();
+      ast->btype = Child(node, 0);
+      List(node, ast->var_defs);
+      return ast;
+    }
+    case ASTCacheKind::varDefT:
+    {
+      auto ast = std::make_unique<VarDefAST>();
+      ast->ident = String(node.str);
+      ast->sym = Sym(node.str);
+      ast->init_val = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::initValT:
+    {
+      auto ast = std::make_unique<InitValAST>();
+      ast->exp = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::lValT:
+    {
+      auto ast = std::make_unique<LValAST>();
+      ast->ident = String(node.str);
+      ast->sym = Sym(node.str);
+      return ast;
+    }
+    case ASTCacheKind::stmtT:
+    {
+      auto ast = std::make_unique<StmtAST>();
+      ast->type = (StmtExpType)node.type;
+      ast->lval = Child(node, 0);
+      ast->exp = Child(node, 1);
+      ast->block = Child(node, 2);
+      return ast;
+    }
+    case ASTCacheKind::expT:
+    {
+      auto ast = std::make_unique<ExpAST>();
+      ast->lor_exp = Child(node, 0);
+      return ast;
+    }
+    case ASTCacheKind::lOrExpT:
+    {
+      auto ast = std::make_unique<LOrExpAST>();
+      ast->op = String(node.op);
+      ast->lor_exp = Child(node, 0);
+      ast->land_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::lAndExpT:
+    {
+      auto ast = std::make_unique<LAndExpAST>();
+      ast->op = String(node.op);
+      ast->land_exp = Child(node, 0);
+      ast->eq_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::eqExpT:
+    {
+      auto ast = std::make_unique<EqExpAST>();
+      ast->op = String(node.op);
+      ast->eq_exp = Child(node, 0);
+      ast->rel_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::relExpT:
+    {
+      auto ast = std::make_unique<RelExpAST>();
+      ast->op = String(node.op);
+      ast->rel_exp = Child(node, 0);
+      ast->add_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::addExpT:
+    {
+      auto ast = std::make_unique<AddExpAST>();
+      ast->op = String(node.op);
+      ast->add_exp = Child(node, 0);
+      ast->mul_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::mulExpT:
+    {
+      auto ast = std::make_unique<MulExpAST>();
+      ast->op = String(node.op);
+      ast->mul_exp = Child(node, 0);
+      ast->unary_exp = Child(node, 1);
+      return ast;
+    }
+    case ASTCacheKind::unaryExpT:
+    {
+      auto ast = std::make_unique<UnaryExpAST>();
+      ast->type = (UnaryExpType)node.type;
+      ast->op = String(node.op);
+      ast->ident = String(node.str);
+      if (ast->type == UnaryExpType::callT)
+        ast->sym = Sym(node.str);
+      ast->exp = Child(node, 0);
+      List(node, ast->args);
+      return ast;
+    }
+    case ASTCacheKind::primaryExpT:
+    {
+      auto ast = std::make_unique<PrimaryExpAST>();
+      ast->type = (PrimaryExpType)node.type;
+      ast->number = node.number;
+      ast->exp = Child(node, 0);
+      ast->lval = Child(node, 1);
+      return ast;
+    }
+    }
+    assert(false);
+    return nullptr;
+  }
+};
@@ -0,0 +1,201 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "IR.hpp"
+#include "MIR.hpp"
+
+// pass 用到的分析, 由 AnalysisManager 缓存.
+// pass 声明自己会使哪些分析失效 (见 Pass.hpp), 没有改动或者没有声明的分析结果可以继续使用
+
+enum AnalysisKind : unsigned
+{
+  ANALYSIS_DOMINATORS = 1, // koopa IR 上的支配树
+  ANALYSIS_LIVENESS = 2,   // MIR 上虚拟寄存器的活跃性
+  ANALYSIS_ALL = ~0u,
+};
+
+// 支配树, 用 Cooper-Harvey-Kennedy 的迭代算法计算
+struct Dominators
+{
+  std::vector<koopa_raw_basic_block_t> order; // 从入口可达的基本块, 逆后序
+  std::unordered_map<koopa_raw_basic_block_t, int> index;
+  std::vector<int> idom; // 按 order 的下标, 入口的 idom 是自己
+
+  bool Reachable(koopa_raw_basic_block_t bb) const
+  {
+    return index.count(bb) > 0;
+  }
+
+  // a 是否支配 b
+  bool Dominates(koopa_raw_basic_block_t a, koopa_raw_basic_block_t b) const
+  {
+    auto ia = index.find(a), ib = index.find(b);
+    if (ia == index.end() || ib == index.end())
+      return false;
+    int x = ib->second;
+    while (x > ia->second)
+      x = idom[x];
+    return x == ia->second;
+  }
+};
+
+Dominators ComputeDominators(koopa_raw_function_t func)
+{
+  Dominators dom;
+  if (func->bbs.len == 0)
+    return dom;
+  // 非递归的 DFS 求后序
+  std::vector<koopa_raw_basic_block_t> post;
+  std::unordered_map<koopa_raw_basic_block_t, bool> visited;
+  std::vector<std::pair<koopa_raw_basic_block_t, size_t>> stack;
+  koopa_raw_basic_block_t entry = IRBlock(func->bbs, 0);
+  stack.push_back({entry, 0});
+  visited[entry] = true;
+  std::unordered_map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> succs;
+  while (!stack.empty())
+  {
+    auto &top = stack.back();
+    auto &s = succs[top.first];
+    if (top.second == 0)
+      s = IRSuccessors(top.first);
+    if (top.second < s.size())
+    {
+      koopa_raw_basic_block_t next = s[top.second++];
+      if (!visited[next])
+      {
+        visited[next] = true;
+        stack.push_back({next, 0});
+      }
+      continue;
+    }
+    post.push_back(top.first);
+    stack.pop_back();
+  }
+  dom.order.assign(post.rbegin(), post.rend());
+  for (size_t i = 0; i < dom.order.size(); ++i)
+    dom.index[dom.order[i]] = i;
+
+  std::vector<std::vector<int>> preds(dom.order.size());
+  for (size_t i = 0; i < dom.order.size(); ++i)
+    for (auto succ : succs[dom.order[i]])
+      preds[dom.index[succ]].push_back(i);
+
+  dom.idom.assign(dom.order.size(), -1);
+  dom.idom[0] = 0;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t b = 1; b < dom.order.size(); ++b)
+    {
+      int new_idom = -1;
+      for (int p : preds[b])
+      {
+        if (dom.idom[p] < 0)
+          continue;
+        if (new_idom < 0)
+        {
+          new_idom = p;
+          continue;
+        }
+        // 沿着支配树向上找公共祖先
+        int x = p, y = new_idom;
+        while (x != y)
+        {
+          while (x > y)
+            x = dom.idom[x];
+          while (y > x)
+            y = dom.idom[y];
+        }
+        new_idom = x;
+      }
+      if (new_idom != dom.idom[b])
+      {
+        dom.idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  return dom;
+}
+
+// 每个基本块入口和出口处活跃的虚拟寄存器, 下标是 寄存器编号 - rv_vreg_base
+struct Liveness
+{
+  std::vector<Bitset> live_in, live_out;
+};
+
+Liveness ComputeLiveness(const MFunction &func)
+{
+  size_t n = func.blocks.size(), vregs = func.vreg_num - rv_vreg_base;
+  Liveness live;
+  live.live_in.assign(n, Bitset(vregs));
+  live.live_out.assign(n, Bitset(vregs));
+  // use: 在块内被定义之前就使用的, def: 块内定义的
+  std::vector<Bitset> use(n, Bitset(vregs)), def(n, Bitset(vregs));
+  for (size_t b = 0; b < n; ++b)
+    for (auto &inst : func.blocks[b].insts)
+    {
+      int uses[2];
+      int k = InstUses(inst, uses);
+      for (int i = 0; i < k; ++i)
+        if (IsVReg(uses[i]) && !def[b].Test(uses[i] - rv_vreg_base))
+          use[b].Set(uses[i] - rv_vreg_base);
+      int d = InstDef(inst);
+      if (d >= 0 && IsVReg(d))
+        def[b].Set(d - rv_vreg_base);
+    }
+  // 逆序迭代到不动点: in = use | (out - def)
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t b = n; b-- > 0;)
+    {
+      for (int s : func.blocks[b].succs)
+        live.live_out[b].UnionWith(live.live_in[s]);
+      Bitset in = live.live_out[b];
+      for (size_t w = 0; w < in.words.size(); ++w)
+        in.words[w] = use[b].words[w] | (in.words[w] & ~def[b].words[w]);
+      changed |= live.live_in[b].UnionWith(in);
+    }
+  }
+  return live;
+}
+
+class AnalysisManager
+{
+public:
+  int dominators_computed = 0;
+  int liveness_computed = 0;
+
+  const Dominators &GetDominators(koopa_raw_function_t func)
+  {
+    auto it = dominators.find(func);
+    if (it != dominators.end())
+      return it->second;
+    dominators_computed++;
+    return dominators[func] = ComputeDominators(func);
+  }
+
+  const Liveness &GetLiveness(const MFunction &func)
+  {
+    auto it = liveness.find(&func);
+    if (it != liveness.end())
+      return it->second;
+    liveness_computed++;
+    return liveness[&func] = ComputeLiveness(func);
+  }
+
+  void Invalidate(unsigned kinds)
+  {
+    if (kinds & ANALYSIS_DOMINATORS)
+      dominators.clear();
+    if (kinds & ANALYSIS_LIVENESS)
+      liveness.clear();
+  }
+
+private:
+  std::unordered_map<koopa_raw_function_t, Dominators> dominators;
+  std::unordered_map<const MFunction *, Liveness> liveness;
+};
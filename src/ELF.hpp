@@ -0,0 +1,245 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "RVAsm.hpp"
+
+// 把 RVProgram 编码成 ELF32 可重定位目标文件 (-obj 模式), 不再需要外部汇编器
+// 输出和 llvm-mc / GNU as 汇编 -riscv 的输出得到的目标文件一致 (不开 relax):
+//   - 同一个函数内跳到局部标签的 branch/jal 直接算出偏移
+//   - call 生成 R_RISCV_CALL, la 生成 R_RISCV_PCREL_HI20 + R_RISCV_PCREL_LO12_I,
+//     后者指向 auipc 处的局部标签 .Lpcrel_hiN
+// 段的顺序: NULL .text .data .rela.text .symtab .strtab .shstrtab
+
+enum ELFSection
+{
+  ELF_NULL, ELF_TEXT, ELF_DATA, ELF_RELA_TEXT, ELF_SYMTAB, ELF_STRTAB, ELF_SHSTRTAB, ELF_SECTION_NUM
+};
+
+const uint8_t R_RISCV_BRANCH = 16;
+const uint8_t R_RISCV_JAL = 17;
+const uint8_t R_RISCV_CALL = 18;
+const uint8_t R_RISCV_PCREL_HI20 = 23;
+const uint8_t R_RISCV_PCREL_LO12_I = 24;
+
+class ELFWriter
+{
+public:
+  explicit ELFWriter(const RVProgram &program) : program(program) {}
+
+  std::string Write()
+  {
+    BuildSymbols();
+    EncodeText();
+
+    std::string shstrtab(1, '\0');
+    uint32_t names[ELF_SECTION_NUM] = {0};
+    const char *section_names[ELF_SECTION_NUM] = {"", ".text", ".data", ".rela.text", ".symtab", ".strtab", ".shstrtab"};
+    for (int i = 1; i < ELF_SECTION_NUM; ++i)
+    {
+      names[i] = shstrtab.size();
+      shstrtab += section_names[i];
+      shstrtab += '\0';
+    }
+
+    // 依次放置各段的内容, 每段按 4 字节对齐
+    std::string out(52, '\0');
+    uint32_t offset[ELF_SECTION_NUM] = {0}, size[ELF_SECTION_NUM] = {0};
+    auto place = [&](int section, const std::string &content)
+    {
+      out.resize((out.size() + 3) / 4 * 4);
+      offset[section] = out.size();
+      size[section] = content.size();
+      out += content;
+    };
+    place(ELF_TEXT, text);
+    place(ELF_DATA, std::string(program.data.begin(), program.data.end()));
+    place(ELF_RELA_TEXT, rela);
+    place(ELF_SYMTAB, symtab);
+    place(ELF_STRTAB, strtab);
+    place(ELF_SHSTRTAB, shstrtab);
+    out.resize((out.size() + 3) / 4 * 4);
+    uint32_t shoff = out.size();
+
+    // 段表
+    auto section = [&](int i, uint32_t type, uint32_t flags, uint32_t link, uint32_t info, uint32_t align, uint32_t entsize)
+    {
+      Put32(out, names[i]);
+      Put32(out, type);
+      Put32(out, flags);
+      Put32(out, 0); // sh_addr
+      Put32(out, offset[i]);
+      Put32(out, size[i]);
+      Put32(out, link);
+      Put32(out, info);
+      Put32(out, align);
+      Put32(out, entsize);
+    };
+    out.append(40, '\0');
+    section(ELF_TEXT, 1 /* PROGBITS */, 0x6 /* ALLOC | EXECINSTR */, 0, 0, 4, 0);
+    section(ELF_DATA, 1 /* PROGBITS */, 0x3 /* WRITE | ALLOC */, 0, 0, 4, 0);
+    section(ELF_RELA_TEXT, 4 /* RELA */, 0x40 /* INFO_LINK */, ELF_SYMTAB, ELF_TEXT, 4, 12);
+    section(ELF_SYMTAB, 2 /* SYMTAB */, 0, ELF_STRTAB, first_global, 4, 16);
+    section(ELF_STRTAB, 3 /* STRTAB */, 0, 0, 0, 1, 0);
+    section(ELF_SHSTRTAB, 3 /* STRTAB */, 0, 0, 0, 1, 0);
+
+    // ELF 头
+    std::string header = "\x7f"
+                         "ELF";
+    header += (char)1; // ELFCLASS32
+    header += (char)1; // ELFDATA2LSB
+    header += (char)1; // EV_CURRENT
+    header.append(9, '\0');
+    Put16(header, 1);   // ET_REL
+    Put16(header, 243); // EM_RISCV
+    Put32(header, 1);   // EV_CURRENT
+    Put32(header, 0);   // e_entry
+    Put32(header, 0);   // e_phoff
+    Put32(header, shoff);
+    Put32(header, 0); // e_flags: 没有 RVC, soft-float ABI
+    Put16(header, 52);
+    Put16(header, 0);
+    Put16(header, 0);
+    Put16(header, 40);
+    Put16(header, ELF_SECTION_NUM);
+    Put16(header, ELF_SHSTRTAB);
+    out.replace(0, header.size(), header);
+    return out;
+  }
+
+private:
+  const RVProgram &program;
+  std::string text, rela, symtab, strtab;
+  std::vector<uint32_t> elf_index; // RVProgram 的符号 -> .symtab 下标
+  std::vector<uint32_t> pcrel_hi;  // auipc 下标 -> .Lpcrel_hiN 的 .symtab 下标
+  uint32_t first_global = 0;
+
+  static void Put16(std::string &out, uint16_t v)
+  {
+    out += (char)(v & 0xff);
+    out += (char)(v >> 8);
+  }
+
+  static void Put32(std::string &out, uint32_t v)
+  {
+    for (int i = 0; i < 4; ++i)
+      out += (char)(v >> (8 * i));
+  }
+
+  [[noreturn]] void Error(const std::string &msg)
+  {
+    std::cerr << "obj: " << msg << std::endl;
+    exit(1);
+  }
+
+  void Symbol(const std::string &name, uint32_t value, uint32_t size, uint8_t info, uint16_t shndx)
+  {
+    Put32(symtab, name.empty() ? 0 : strtab.size());
+    if (!name.empty())
+    {
+      strtab += name;
+      strtab += '\0';
+    }
+    Put32(symtab, value);
+    Put32(symtab, size);
+    symtab += (char)info;
+    symtab += '\0'; // st_other
+    Put16(symtab, shndx);
+  }
+
+  // ELF 要求局部符号排在全局符号前面
+  void BuildSymbols()
+  {
+    strtab.assign(1, '\0');
+    Symbol("", 0, 0, 0, 0);
+    uint32_t count = 1;
+    elf_index.assign(program.symbols.size(), 0);
+    for (size_t i = 0; i < program.symbols.size(); ++i)
+    {
+      const RVSymbol &sym = program.symbols[i];
+      // 基本块的 .L 标签和汇编器一样不放进符号表, 跳到它们的指令在 EncodeText 中直接算出偏移
+      if (sym.global || sym.section < 0 || IsLocalLabel(sym))
+        continue;
+      Symbol(sym.name, sym.offset, sym.size, sym.type == 'F' ? 2 : sym.type == 'O' ? 1 : 0, sym.section + 1);
+      elf_index[i] = count++;
+    }
+    pcrel_hi.assign(program.text.size(), 0);
+    int pcrel_count = 0;
+    for (size_t i = 0; i < program.text.size(); ++i)
+      if (program.text[i].reloc == RV_R_PCREL_HI20)
+      {
+        Symbol(".Lpcrel_hi" + std::to_string(pcrel_count++), i * 4, 0, 0, ELF_TEXT);
+        pcrel_hi[i] = count++;
+      }
+    first_global = count;
+    for (size_t i = 0; i < program.symbols.size(); ++i)
+    {
+      const RVSymbol &sym = program.symbols[i];
+      if (!sym.global && sym.section >= 0)
+        continue;
+      // 未定义的符号 (如库函数) 是全局的, shndx 为 0
+      uint8_t type = sym.type == 'F' ? 2 : sym.type == 'O' ? 1 : 0;
+      Symbol(sym.name, sym.offset, sym.size, 1 << 4 | type, sym.section < 0 ? 0 : sym.section + 1);
+      elf_index[i] = count++;
+    }
+  }
+
+  void Reloc(size_t index, uint32_t sym, uint8_t type)
+  {
+    Put32(rela, index * 4);
+    Put32(rela, sym << 8 | type);
+    Put32(rela, 0); // r_addend
+  }
+
+  void EncodeText()
+  {
+    for (size_t i = 0; i < program.text.size(); ++i)
+    {
+      const RVInst &inst = program.text[i];
+      int32_t imm = inst.imm;
+      switch (inst.reloc)
+      {
+      case RV_R_NONE:
+      case RV_R_FRAME: // 只在 MIR 中出现, RVProgram 里已经不存在
+        break;
+      case RV_R_BRANCH:
+      case RV_R_JAL:
+      {
+        const RVSymbol &sym = program.symbols[inst.sym];
+        if (sym.section != 0 || sym.global)
+        {
+          Reloc(i, elf_index[inst.sym], inst.reloc == RV_R_BRANCH ? R_RISCV_BRANCH : R_RISCV_JAL);
+          imm = 0;
+          break;
+        }
+        imm = (int32_t)sym.offset - (int32_t)(i * 4);
+        int32_t limit = inst.reloc == RV_R_BRANCH ? 1 << 12 : 1 << 20;
+        if (imm < -limit || imm >= limit)
+          Error("jump to " + sym.name + " out of range");
+        break;
+      }
+      case RV_R_CALL:
+        Reloc(i, elf_index[inst.sym], R_RISCV_CALL);
+        imm = 0;
+        break;
+      case RV_R_PCREL_HI20:
+        Reloc(i, elf_index[inst.sym], R_RISCV_PCREL_HI20);
+        imm = 0;
+        break;
+      case RV_R_PCREL_LO12_I:
+        Reloc(i, pcrel_hi[inst.pair], R_RISCV_PCREL_LO12_I);
+        imm = 0;
+        break;
+      }
+      Put32(text, RVEncode(inst, imm));
+    }
+  }
+};
+
+// 生成目标文件的内容
+std::string WriteELF(const RVProgram &program)
+{
+  return ELFWriter(program).Write();
+}
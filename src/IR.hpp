@@ -0,0 +1,205 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+// 在 raw program 上做变换用的工具
+// libkoopa 给出的 raw program 接口是只读的, IR pass 直接 const_cast 修改它;
+// 新建的值放在 ir_arena 里 (基本块, slice 的缓冲区, 名字也各有一个 arena), 和 builder 一样活到程序结束.
+// 修改之后不再维护 used_by, 后面的代码都不依赖它
+
+template <typename T>
+T *Mut(const T *ptr)
+{
+  return const_cast<T *>(ptr);
+}
+
+std::deque<koopa_raw_value_data_t> ir_arena;
+std::deque<koopa_raw_basic_block_data_t> ir_block_arena;
+std::deque<std::vector<const void *>> ir_slice_arena;
+std::deque<std::string> ir_name_arena;
+std::unordered_map<int32_t, koopa_raw_value_t> ir_integers;
+const koopa_raw_type_kind_t ir_int32_type = {KOOPA_RTT_INT32, {}};
+const koopa_raw_type_kind_t ir_unit_type = {KOOPA_RTT_UNIT, {}};
+const koopa_raw_type_kind_t ir_int32_ptr_type = []
+{
+  koopa_raw_type_kind_t ty = {KOOPA_RTT_POINTER, {}};
+  ty.data.pointer.base = &ir_int32_type;
+  return ty;
+}();
+
+// 新建一个值, kind 由调用者填写
+koopa_raw_value_data_t *IRNewValue(koopa_raw_type_t ty)
+{
+  ir_arena.emplace_back();
+  koopa_raw_value_data_t &data = ir_arena.back();
+  data.ty = ty;
+  data.name = nullptr;
+  data.used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+  return &data;
+}
+
+// 新建 (或复用) 一个整数常量
+koopa_raw_value_t IRInteger(int32_t value)
+{
+  auto it = ir_integers.find(value);
+  if (it != ir_integers.end())
+    return it->second;
+  koopa_raw_value_data_t *data = IRNewValue(&ir_int32_type);
+  data->kind.tag = KOOPA_RVT_INTEGER;
+  data->kind.data.integer.value = value;
+  return ir_integers[value] = data;
+}
+
+// 新建一个 slice, 内容复制到 ir_slice_arena 里
+koopa_raw_slice_t IRSlice(const std::vector<const void *> &items, koopa_raw_slice_item_kind_t kind)
+{
+  ir_slice_arena.push_back(items);
+  return {ir_slice_arena.back().data(), (uint32_t)items.size(), kind};
+}
+
+const char *IRName(const std::string &name)
+{
+  ir_name_arena.push_back(name);
+  return ir_name_arena.back().c_str();
+}
+
+// 新建一个没有参数的空基本块
+koopa_raw_basic_block_data_t *IRNewBlock(const std::string &name)
+{
+  ir_block_arena.emplace_back();
+  koopa_raw_basic_block_data_t &bb = ir_block_arena.back();
+  bb.name = IRName(name);
+  bb.params = {nullptr, 0, KOOPA_RSIK_VALUE};
+  bb.used_by = {nullptr, 0, KOOPA_RSIK_VALUE};
+  bb.insts = {nullptr, 0, KOOPA_RSIK_VALUE};
+  return &bb;
+}
+
+inline koopa_raw_basic_block_t IRBlock(const koopa_raw_slice_t &slice, size_t i)
+{
+  return reinterpret_cast<koopa_raw_basic_block_t>(slice.buffer[i]);
+}
+
+inline koopa_raw_value_t IRValue(const koopa_raw_slice_t &slice, size_t i)
+{
+  return reinterpret_cast<koopa_raw_value_t>(slice.buffer[i]);
+}
+
+inline koopa_raw_function_t IRFunction(const koopa_raw_slice_t &slice, size_t i)
+{
+  return reinterpret_cast<koopa_raw_function_t>(slice.buffer[i]);
+}
+
+// 基本块的后继
+std::vector<koopa_raw_basic_block_t> IRSuccessors(koopa_raw_basic_block_t bb)
+{
+  if (bb->insts.len == 0)
+    return {};
+  koopa_raw_value_t last = IRValue(bb->insts, bb->insts.len - 1);
+  if (last->kind.tag == KOOPA_RVT_BRANCH)
+    return {last->kind.data.branch.true_bb, last->kind.data.branch.false_bb};
+  if (last->kind.tag == KOOPA_RVT_JUMP)
+    return {last->kind.data.jump.target};
+  return {};
+}
+
+// 指令的操作数 (可以通过指针替换). 遇到不认识的指令返回 false, 调用者应该放弃变换
+bool IROperands(koopa_raw_value_t value, std::vector<koopa_raw_value_t *> &ops)
+{
+  auto &kind = Mut(value)->kind;
+  switch (kind.tag)
+  {
+  case KOOPA_RVT_ALLOC:
+    return true;
+  case KOOPA_RVT_LOAD:
+    ops.push_back(&kind.data.load.src);
+    return true;
+  case KOOPA_RVT_STORE:
+    ops.push_back(&kind.data.store.value);
+    ops.push_back(&kind.data.store.dest);
+    return true;
+  case KOOPA_RVT_BINARY:
+    ops.push_back(&kind.data.binary.lhs);
+    ops.push_back(&kind.data.binary.rhs);
+    return true;
+  case KOOPA_RVT_BRANCH:
+    ops.push_back(&kind.data.branch.cond);
+    return kind.data.branch.true_args.len == 0 && kind.data.branch.false_args.len == 0;
+  case KOOPA_RVT_JUMP:
+    return kind.data.jump.args.len == 0;
+  case KOOPA_RVT_CALL:
+    for (size_t i = 0; i < kind.data.call.args.len; ++i)
+      ops.push_back(reinterpret_cast<koopa_raw_value_t *>(&kind.data.call.args.buffer[i]));
+    return true;
+  case KOOPA_RVT_RETURN:
+    if (kind.data.ret.value)
+      ops.push_back(&kind.data.ret.value);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// 指令是否可以在结果没用时删掉
+bool IRIsPure(koopa_raw_value_t value)
+{
+  switch (value->kind.tag)
+  {
+  case KOOPA_RVT_ALLOC:
+  case KOOPA_RVT_LOAD:
+    return true;
+  case KOOPA_RVT_BINARY:
+    // 除以 0 在 RISC-V 上不会出错, 可以删
+    return true;
+  default:
+    return false;
+  }
+}
+
+// 编译期计算二元运算, 和 RISC-V 上的结果一致: 32 位回绕, 移位量取低 5 位,
+// 除以 0 得 -1 (取模得被除数), INT32_MIN / -1 得 INT32_MIN (取模得 0)
+int32_t IRFoldBinary(koopa_raw_binary_op_t op, int32_t l, int32_t r)
+{
+  uint32_t ul = l, ur = r;
+  switch (op)
+  {
+  case KOOPA_RBO_NOT_EQ: return l != r;
+  case KOOPA_RBO_EQ: return l == r;
+  case KOOPA_RBO_GT: return l > r;
+  case KOOPA_RBO_LT: return l < r;
+  case KOOPA_RBO_GE: return l >= r;
+  case KOOPA_RBO_LE: return l <= r;
+  case KOOPA_RBO_ADD: return (int32_t)(ul + ur);
+  case KOOPA_RBO_SUB: return (int32_t)(ul - ur);
+  case KOOPA_RBO_MUL: return (int32_t)(ul * ur);
+  case KOOPA_RBO_DIV: return r == 0 ? -1 : (l == INT32_MIN && r == -1) ? l : l / r;
+  case KOOPA_RBO_MOD: return r == 0 ? l : (l == INT32_MIN && r == -1) ? 0 : l % r;
+  case KOOPA_RBO_AND: return l & r;
+  case KOOPA_RBO_OR: return l | r;
+  case KOOPA_RBO_XOR: return l ^ r;
+  case KOOPA_RBO_SHL: return (int32_t)(ul << (r & 31));
+  case KOOPA_RBO_SHR: return (int32_t)(ul >> (r & 31));
+  case KOOPA_RBO_SAR: return l >> (r & 31);
+  }
+  assert(false);
+  return 0;
+}
+
+// 删除基本块中满足 dead 的指令, 返回删除的条数
+template <typename F>
+int IRRemoveInsts(koopa_raw_basic_block_t bb, F dead)
+{
+  auto &insts = Mut(bb)->insts;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < insts.len; ++i)
+    if (!dead(IRValue(insts, i)))
+      insts.buffer[n++] = insts.buffer[i];
+  int removed = insts.len - n;
+  insts.len = n;
+  return removed;
+}
@@ -0,0 +1,474 @@
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Analysis.hpp"
+#include "IR.hpp"
+
+// koopa IR 上的优化 pass, 直接修改 raw program (见 IR.hpp)
+
+// 按替换表改写函数中所有指令的操作数, 替换可以是链式的 (a -> b -> c)
+void IRReplaceUses(koopa_raw_function_t func, std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> &replace)
+{
+  if (replace.empty())
+    return;
+  std::vector<koopa_raw_value_t *> ops;
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+    for (size_t j = 0; j < bb->insts.len; ++j)
+    {
+      ops.clear();
+      IROperands(IRValue(bb->insts, j), ops);
+      for (auto op : ops)
+      {
+        auto it = replace.find(*op);
+        while (it != replace.end())
+        {
+          *op = it->second;
+          it = replace.find(*op);
+        }
+      }
+    }
+  }
+}
+
+// 函数里是否只有 IROperands 认识的指令
+bool IRSupported(koopa_raw_function_t func)
+{
+  std::vector<koopa_raw_value_t *> ops;
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+    if (bb->params.len > 0)
+      return false;
+    for (size_t j = 0; j < bb->insts.len; ++j)
+      if (!IROperands(IRValue(bb->insts, j), ops))
+        return false;
+  }
+  return true;
+}
+
+// dce: 删掉结果没有用到的纯指令, 以及只写不读的局部变量 (alloc 和对它的 store)
+int RunDCE(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  int changes = 0;
+  std::vector<koopa_raw_value_t *> ops;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (!IRSupported(func))
+      continue;
+    // 每个值被用了多少次; alloc 被 load 了多少次
+    std::unordered_map<koopa_raw_value_t, int> uses, loads;
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        ops.clear();
+        IROperands(inst, ops);
+        for (auto op : ops)
+          uses[*op]++;
+        if (inst->kind.tag == KOOPA_RVT_LOAD)
+          loads[inst->kind.data.load.src]++;
+      }
+    }
+    // 从未读过, 并且地址只用作 store 目标的 alloc
+    std::unordered_set<koopa_raw_value_t> dead_allocs;
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        if (inst->kind.tag == KOOPA_RVT_ALLOC && loads[inst] == 0)
+          dead_allocs.insert(inst);
+        else if (inst->kind.tag == KOOPA_RVT_STORE)
+          dead_allocs.erase(inst->kind.data.store.value);
+        else if (inst->kind.tag == KOOPA_RVT_CALL)
+          for (size_t k = 0; k < inst->kind.data.call.args.len; ++k)
+            dead_allocs.erase(IRValue(inst->kind.data.call.args, k));
+      }
+    }
+    // 用工作表传播: 删掉一条指令后, 它的操作数可能也变得无用
+    std::unordered_set<koopa_raw_value_t> dead;
+    std::vector<koopa_raw_value_t> worklist;
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        bool dead_inst;
+        if (inst->kind.tag == KOOPA_RVT_STORE)
+          dead_inst = dead_allocs.count(inst->kind.data.store.dest) > 0;
+        else if (inst->kind.tag == KOOPA_RVT_ALLOC)
+          dead_inst = dead_allocs.count(inst) > 0;
+        else
+          dead_inst = IRIsPure(inst) && uses[inst] == 0;
+        if (dead_inst)
+          worklist.push_back(inst);
+      }
+    }
+    while (!worklist.empty())
+    {
+      koopa_raw_value_t inst = worklist.back();
+      worklist.pop_back();
+      if (!dead.insert(inst).second)
+        continue;
+      ops.clear();
+      IROperands(inst, ops);
+      for (auto op : ops)
+        if (--uses[*op] == 0 && IRIsPure(*op))
+          worklist.push_back(*op);
+    }
+    if (dead.empty())
+      continue;
+    for (size_t i = 0; i < func->bbs.len; ++i)
+      changes += IRRemoveInsts(IRBlock(func->bbs, i), [&](koopa_raw_value_t inst)
+                               { return dead.count(inst) > 0; });
+  }
+  return changes;
+}
+
+// load-forward: 基本块内的 store -> load 转发和重复 load 消除.
+// 记录每个变量 (alloc 或全局变量) 当前已知的值, load 直接换成这个值
+int RunLoadForward(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  int changes = 0;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (!IRSupported(func))
+      continue;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    auto resolve = [&](koopa_raw_value_t value)
+    {
+      auto it = replace.find(value);
+      while (it != replace.end())
+      {
+        value = it->second;
+        it = replace.find(value);
+      }
+      return value;
+    };
+    for (size_t i = 0; i < func->bbs.len; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> known;
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        switch (inst->kind.tag)
+        {
+        case KOOPA_RVT_STORE:
+          known[inst->kind.data.store.dest] = resolve(inst->kind.data.store.value);
+          break;
+        case KOOPA_RVT_LOAD:
+        {
+          auto it = known.find(inst->kind.data.load.src);
+          if (it != known.end())
+            replace[inst] = it->second;
+          else
+            known[inst->kind.data.load.src] = inst;
+          break;
+        }
+        case KOOPA_RVT_CALL:
+          // 被调用的函数可能修改全局变量
+          for (auto it = known.begin(); it != known.end();)
+            if (it->first->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+              it = known.erase(it);
+            else
+              ++it;
+          break;
+        default:
+          break;
+        }
+      }
+    }
+    if (replace.empty())
+      continue;
+    IRReplaceUses(func, replace);
+    for (size_t i = 0; i < func->bbs.len; ++i)
+      changes += IRRemoveInsts(IRBlock(func->bbs, i), [&](koopa_raw_value_t inst)
+                               { return replace.count(inst) > 0; });
+  }
+  return changes;
+}
+
+// sccp 用的格: 还没算出 (top), 常量, 不是常量 (bottom)
+enum class LatticeKind : uint8_t
+{
+  topT,
+  constT,
+  bottomT
+};
+
+struct Lattice
+{
+  LatticeKind kind = LatticeKind::topT;
+  int32_t value = 0;
+
+  bool operator==(const Lattice &other) const
+  {
+    return kind == other.kind && (kind != LatticeKind::constT || value == other.value);
+  }
+  bool operator!=(const Lattice &other) const
+  {
+    return !(*this == other);
+  }
+};
+
+inline Lattice LatticeMeet(const Lattice &a, const Lattice &b)
+{
+  if (a.kind == LatticeKind::topT)
+    return b;
+  if (b.kind == LatticeKind::topT || a == b)
+    return a;
+  return {LatticeKind::bottomT, 0};
+}
+
+// sccp: 稀疏条件常量传播 (Wegman-Zadeck).
+// 前端生成的是 alloc/load/store 形式的 IR, 局部变量的值不在 SSA 值里, 所以除了每个 SSA 值的格,
+// 还对可提升的 alloc (地址只用作 load 的源和 store 的目标) 做按基本块的数据流:
+// 块入口的值是所有可执行前驱出口的交汇, 入口块中变量的初值是 bottom.
+// 只沿可执行的边传播, 条件是常量的 br 只有一边可执行. 反复扫描可执行的块直到不动点, 然后
+// 格值是常量的 load 和 binary 换成立即数, 常量条件的 br 换成 jump, 不可达的块留给 unreachable 删除
+int RunSCCP(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  int changes = 0;
+  std::vector<koopa_raw_value_t *> ops;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (func->bbs.len == 0 || !IRSupported(func))
+      continue;
+    size_t n = func->bbs.len;
+    std::unordered_map<koopa_raw_basic_block_t, int> block_index;
+    for (size_t i = 0; i < n; ++i)
+      block_index[IRBlock(func->bbs, i)] = i;
+    std::vector<std::vector<int>> succs(n);
+    std::vector<std::vector<std::pair<int, int>>> preds(n); // (前驱, 是它的第几个后继)
+    for (size_t i = 0; i < n; ++i)
+      for (auto succ : IRSuccessors(IRBlock(func->bbs, i)))
+      {
+        int s = block_index.at(succ);
+        preds[s].push_back({(int)i, (int)succs[i].size()});
+        succs[i].push_back(s);
+      }
+
+    // 可提升的 alloc 编号为 0, 1, ..., 地址有其他用途的记为 -1
+    std::unordered_map<koopa_raw_value_t, int> vars;
+    int num_vars = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        if (inst->kind.tag == KOOPA_RVT_ALLOC && inst->ty->data.pointer.base->tag == KOOPA_RTT_INT32)
+          vars[inst] = num_vars++;
+      }
+    }
+    for (size_t i = 0; i < n; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        if (inst->kind.tag == KOOPA_RVT_LOAD)
+          continue;
+        ops.clear();
+        IROperands(inst, ops);
+        for (auto op : ops)
+          if (!(inst->kind.tag == KOOPA_RVT_STORE && op == &Mut(inst)->kind.data.store.dest))
+          {
+            auto it = vars.find(*op);
+            if (it != vars.end())
+              it->second = -1;
+          }
+      }
+    }
+    auto var_index = [&](koopa_raw_value_t ptr)
+    {
+      auto it = vars.find(ptr);
+      return it == vars.end() ? -1 : it->second;
+    };
+
+    std::unordered_map<koopa_raw_value_t, Lattice> values; // 指令结果, 没有记录的是 top
+    auto get = [&](koopa_raw_value_t value) -> Lattice
+    {
+      switch (value->kind.tag)
+      {
+      case KOOPA_RVT_INTEGER:
+        return {LatticeKind::constT, value->kind.data.integer.value};
+      case KOOPA_RVT_LOAD:
+      case KOOPA_RVT_BINARY:
+      case KOOPA_RVT_CALL:
+      {
+        auto it = values.find(value);
+        return it == values.end() ? Lattice() : it->second;
+      }
+      default:
+        // 函数参数, 全局变量等
+        return {LatticeKind::bottomT, 0};
+      }
+    };
+
+    std::vector<bool> executable(n);
+    std::vector<std::vector<bool>> edge_executable(n);
+    for (size_t i = 0; i < n; ++i)
+      edge_executable[i].assign(succs[i].size(), false);
+    std::vector<std::vector<Lattice>> out_states(n, std::vector<Lattice>(num_vars));
+    executable[0] = true;
+    bool changed = true;
+    auto update = [&](koopa_raw_value_t inst, const Lattice &lattice)
+    {
+      Lattice &old = values[inst];
+      Lattice now = LatticeMeet(old, lattice);
+      if (now != old)
+      {
+        old = now;
+        changed = true;
+      }
+    };
+    auto mark_edge = [&](int from, int k)
+    {
+      if (edge_executable[from][k])
+        return;
+      edge_executable[from][k] = true;
+      executable[succs[from][k]] = true;
+      changed = true;
+    };
+    std::vector<Lattice> state;
+    while (changed)
+    {
+      changed = false;
+      for (size_t i = 0; i < n; ++i)
+      {
+        if (!executable[i])
+          continue;
+        state.assign(num_vars, i == 0 ? Lattice{LatticeKind::bottomT, 0} : Lattice());
+        for (auto [p, k] : preds[i])
+          if (edge_executable[p][k])
+            for (int v = 0; v < num_vars; ++v)
+              state[v] = LatticeMeet(state[v], out_states[p][v]);
+        koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+        for (size_t j = 0; j < bb->insts.len; ++j)
+        {
+          koopa_raw_value_t inst = IRValue(bb->insts, j);
+          auto &kind = inst->kind;
+          switch (kind.tag)
+          {
+          case KOOPA_RVT_STORE:
+          {
+            int v = var_index(kind.data.store.dest);
+            if (v >= 0)
+              state[v] = get(kind.data.store.value);
+            break;
+          }
+          case KOOPA_RVT_LOAD:
+          {
+            int v = var_index(kind.data.load.src);
+            update(inst, v >= 0 ? state[v] : Lattice{LatticeKind::bottomT, 0});
+            break;
+          }
+          case KOOPA_RVT_BINARY:
+          {
+            Lattice lhs = get(kind.data.binary.lhs), rhs = get(kind.data.binary.rhs);
+            if (lhs.kind == LatticeKind::constT && rhs.kind == LatticeKind::constT)
+              update(inst, {LatticeKind::constT, IRFoldBinary(kind.data.binary.op, lhs.value, rhs.value)});
+            else if (lhs.kind == LatticeKind::bottomT || rhs.kind == LatticeKind::bottomT)
+              update(inst, {LatticeKind::bottomT, 0});
+            break;
+          }
+          case KOOPA_RVT_CALL:
+            update(inst, {LatticeKind::bottomT, 0});
+            break;
+          case KOOPA_RVT_BRANCH:
+          {
+            Lattice cond = get(kind.data.branch.cond);
+            if (cond.kind == LatticeKind::constT)
+              mark_edge(i, cond.value ? 0 : 1);
+            else if (cond.kind == LatticeKind::bottomT)
+            {
+              mark_edge(i, 0);
+              mark_edge(i, 1);
+            }
+            break;
+          }
+          case KOOPA_RVT_JUMP:
+            mark_edge(i, 0);
+            break;
+          default:
+            break;
+          }
+        }
+        if (state != out_states[i])
+        {
+          out_states[i].swap(state);
+          changed = true;
+        }
+      }
+    }
+
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (!executable[i])
+        continue;
+      koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        auto &kind = Mut(inst)->kind;
+        if (kind.tag == KOOPA_RVT_LOAD || kind.tag == KOOPA_RVT_BINARY)
+        {
+          Lattice lattice = get(inst);
+          if (lattice.kind == LatticeKind::constT)
+            replace[inst] = IRInteger(lattice.value);
+        }
+        else if (kind.tag == KOOPA_RVT_BRANCH && get(kind.data.branch.cond).kind == LatticeKind::constT)
+        {
+          koopa_raw_basic_block_t target = get(kind.data.branch.cond).value ? kind.data.branch.true_bb : kind.data.branch.false_bb;
+          kind.tag = KOOPA_RVT_JUMP;
+          kind.data.jump.target = target;
+          kind.data.jump.args = {nullptr, 0, KOOPA_RSIK_VALUE};
+          changes++;
+        }
+      }
+    }
+    if (replace.empty())
+      continue;
+    IRReplaceUses(func, replace);
+    for (size_t i = 0; i < n; ++i)
+      changes += IRRemoveInsts(IRBlock(func->bbs, i), [&](koopa_raw_value_t inst)
+                               { return replace.count(inst) > 0; });
+  }
+  return changes;
+}
+
+// unreachable: 删掉从入口不可达的基本块
+int RunUnreachable(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  int changes = 0;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (func->bbs.len == 0)
+      continue;
+    const Dominators &dom = am.GetDominators(func);
+    if (dom.order.size() == func->bbs.len)
+      continue;
+    auto &bbs = Mut(func)->bbs;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < bbs.len; ++i)
+      if (dom.Reachable(IRBlock(bbs, i)))
+        bbs.buffer[n++] = bbs.buffer[i];
+    changes += bbs.len - n;
+    bbs.len = n;
+  }
+  return changes;
+}
@@ -0,0 +1,302 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Analysis.hpp"
+#include "IR.hpp"
+#include "IROpt.hpp"
+#include "Timer.hpp"
+
+// inline: 自底向上的函数内联
+// 先建调用图, 用 Tarjan 算法求强连通分量. 分量按后序给出, 被调用的函数在前,
+// 所以处理一个函数时, 它调用的函数已经内联过了. 同一个分量里的调用 (递归) 不内联.
+// 代价: 被调用函数的指令条数 (不算 alloc), 减去省下的调用指令 (call 和每个实参),
+// 每个常量实参再减 inline_const_arg_bonus (内联后常量传播通常能删掉用到它的指令).
+// 代价不超过 inline_threshold 时内联, 但整个程序 (边解析边编译时是一次编译的那部分)
+// 最多增长原大小的 inline_growth_percent% (至少 inline_min_growth 条), 预算用完就不再内联.
+// 加上 -time 时, 在 stderr 输出每个做了内联的函数 "[inline] <函数> <调用点个数> +<增加的指令数>"
+
+const int inline_threshold = 24;
+const int inline_const_arg_bonus = 4;
+const int inline_growth_percent = 50;
+const int inline_min_growth = 256;
+
+// 函数的大小: 指令条数, 不算 alloc
+int IRFunctionSize(koopa_raw_function_t func)
+{
+  int size = 0;
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+    for (size_t j = 0; j < bb->insts.len; ++j)
+      size += IRValue(bb->insts, j)->kind.tag != KOOPA_RVT_ALLOC;
+  }
+  return size;
+}
+
+// 调用图, 只包含有定义的函数
+struct CallGraph
+{
+  std::vector<koopa_raw_function_t> funcs;
+  std::unordered_map<koopa_raw_function_t, int> ids;
+  std::vector<std::vector<int>> callees;
+  std::vector<int> scc;   // 每个函数所在的强连通分量
+  std::vector<int> order; // 按分量的后序排列的函数, 被调用的在前
+};
+
+CallGraph BuildCallGraph(const koopa_raw_program_t &program)
+{
+  CallGraph cg;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (func->bbs.len == 0)
+      continue;
+    cg.ids[func] = cg.funcs.size();
+    cg.funcs.push_back(func);
+  }
+  int n = cg.funcs.size();
+  cg.callees.resize(n);
+  for (int f = 0; f < n; ++f)
+    for (size_t i = 0; i < cg.funcs[f]->bbs.len; ++i)
+    {
+      koopa_raw_basic_block_t bb = IRBlock(cg.funcs[f]->bbs, i);
+      for (size_t j = 0; j < bb->insts.len; ++j)
+      {
+        koopa_raw_value_t inst = IRValue(bb->insts, j);
+        if (inst->kind.tag != KOOPA_RVT_CALL)
+          continue;
+        auto it = cg.ids.find(inst->kind.data.call.callee);
+        if (it != cg.ids.end())
+          cg.callees[f].push_back(it->second);
+      }
+    }
+
+  // Tarjan: 一个分量的所有函数出栈时, 它调用的分量都已经出栈了
+  cg.scc.assign(n, -1);
+  std::vector<int> index(n, -1), low(n), stack;
+  std::vector<bool> on_stack(n);
+  int counter = 0, scc_num = 0;
+  std::function<void(int)> visit = [&](int f)
+  {
+    index[f] = low[f] = counter++;
+    stack.push_back(f);
+    on_stack[f] = true;
+    for (int g : cg.callees[f])
+    {
+      if (index[g] < 0)
+      {
+        visit(g);
+        low[f] = std::min(low[f], low[g]);
+      }
+      else if (on_stack[g])
+        low[f] = std::min(low[f], index[g]);
+    }
+    if (low[f] != index[f])
+      return;
+    int g;
+    do
+    {
+      g = stack.back();
+      stack.pop_back();
+      on_stack[g] = false;
+      cg.scc[g] = scc_num;
+      cg.order.push_back(g);
+    } while (g != f);
+    scc_num++;
+  };
+  for (int f = 0; f < n; ++f)
+    if (index[f] < 0)
+      visit(f);
+  return cg;
+}
+
+// 内联 bbs[b] 的第 i 条指令 (对 callee 的调用):
+// 调用点之后的指令移到新的基本块 (后半段), bbs[b] 在调用点处跳到复制出的 callee 入口.
+// 参数换成实参; ret 换成 "返回值存到一个新的局部变量, 跳到后半段",
+// 调用指令本身改成后半段开头读这个变量的 load, 用到调用结果的指令不用改.
+// 复制出的 alloc 不放进基本块, 而是加到 entry_allocs, 由调用者放到入口块
+void InlineCallSite(std::vector<koopa_raw_basic_block_t> &bbs, size_t b, uint32_t i, int site,
+                    std::vector<const void *> &entry_allocs)
+{
+  koopa_raw_basic_block_t bb = bbs[b];
+  koopa_raw_value_t call = IRValue(bb->insts, i);
+  koopa_raw_function_t callee = call->kind.data.call.callee;
+  std::string prefix = "%inline" + std::to_string(site) + "_";
+
+  koopa_raw_value_t ret_slot = nullptr;
+  std::vector<const void *> rest_insts;
+  if (callee->ty->data.function.ret->tag != KOOPA_RTT_UNIT)
+  {
+    koopa_raw_value_data_t *slot = IRNewValue(&ir_int32_ptr_type);
+    slot->kind.tag = KOOPA_RVT_ALLOC;
+    entry_allocs.push_back(slot);
+    ret_slot = slot;
+    rest_insts.push_back(call);
+  }
+  rest_insts.insert(rest_insts.end(), bb->insts.buffer + i + 1, bb->insts.buffer + bb->insts.len);
+  koopa_raw_basic_block_data_t *rest = IRNewBlock(prefix + "ret");
+  rest->insts = IRSlice(rest_insts, KOOPA_RSIK_VALUE);
+
+  std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> values;
+  std::unordered_map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> blocks;
+  for (size_t p = 0; p < callee->params.len; ++p)
+    values[IRValue(callee->params, p)] = IRValue(call->kind.data.call.args, p);
+  std::vector<koopa_raw_basic_block_data_t *> clones;
+  for (size_t k = 0; k < callee->bbs.len; ++k)
+  {
+    koopa_raw_basic_block_t cb = IRBlock(callee->bbs, k);
+    clones.push_back(IRNewBlock(prefix + (cb->name ? cb->name + 1 : std::to_string(k))));
+    blocks[cb] = clones.back();
+  }
+  auto jump = [&](koopa_raw_basic_block_t target)
+  {
+    koopa_raw_value_data_t *inst = IRNewValue(&ir_unit_type);
+    inst->kind.tag = KOOPA_RVT_JUMP;
+    inst->kind.data.jump.target = target;
+    inst->kind.data.jump.args = {nullptr, 0, KOOPA_RSIK_VALUE};
+    return inst;
+  };
+
+  // 先复制所有指令, 再统一改写操作数 (基本块的顺序不一定是定义在前)
+  std::vector<koopa_raw_value_data_t *> copied;
+  for (size_t k = 0; k < callee->bbs.len; ++k)
+  {
+    koopa_raw_basic_block_t cb = IRBlock(callee->bbs, k);
+    std::vector<const void *> insts;
+    for (size_t j = 0; j < cb->insts.len; ++j)
+    {
+      koopa_raw_value_t inst = IRValue(cb->insts, j);
+      if (inst->kind.tag == KOOPA_RVT_RETURN)
+      {
+        if (ret_slot)
+        {
+          koopa_raw_value_data_t *store = IRNewValue(&ir_unit_type);
+          store->kind.tag = KOOPA_RVT_STORE;
+          store->kind.data.store.value = inst->kind.data.ret.value;
+          store->kind.data.store.dest = ret_slot;
+          copied.push_back(store);
+          insts.push_back(store);
+        }
+        insts.push_back(jump(rest));
+        continue;
+      }
+      koopa_raw_value_data_t *copy = IRNewValue(inst->ty);
+      copy->name = inst->name;
+      copy->kind = inst->kind;
+      // call 的实参在 slice 里, 改写前先复制一份, 不能改到原函数
+      if (inst->kind.tag == KOOPA_RVT_CALL)
+      {
+        auto &args = inst->kind.data.call.args;
+        copy->kind.data.call.args = IRSlice(std::vector<const void *>(args.buffer, args.buffer + args.len), KOOPA_RSIK_VALUE);
+      }
+      else if (inst->kind.tag == KOOPA_RVT_BRANCH)
+      {
+        copy->kind.data.branch.true_bb = blocks.at(inst->kind.data.branch.true_bb);
+        copy->kind.data.branch.false_bb = blocks.at(inst->kind.data.branch.false_bb);
+      }
+      else if (inst->kind.tag == KOOPA_RVT_JUMP)
+        copy->kind.data.jump.target = blocks.at(inst->kind.data.jump.target);
+      values[inst] = copy;
+      copied.push_back(copy);
+      if (inst->kind.tag == KOOPA_RVT_ALLOC)
+        entry_allocs.push_back(copy);
+      else
+        insts.push_back(copy);
+    }
+    clones[k]->insts = IRSlice(insts, KOOPA_RSIK_VALUE);
+  }
+  std::vector<koopa_raw_value_t *> ops;
+  for (auto copy : copied)
+  {
+    ops.clear();
+    IROperands(copy, ops);
+    for (auto op : ops)
+    {
+      auto it = values.find(*op);
+      if (it != values.end())
+        *op = it->second;
+    }
+  }
+
+  // 前半段跳到复制出的入口, 调用指令改成读返回值
+  std::vector<const void *> head(bb->insts.buffer, bb->insts.buffer + i);
+  head.push_back(jump(clones[0]));
+  Mut(bb)->insts = IRSlice(head, KOOPA_RSIK_VALUE);
+  if (ret_slot)
+  {
+    auto &kind = Mut(call)->kind;
+    kind.tag = KOOPA_RVT_LOAD;
+    kind.data.load.src = ret_slot;
+  }
+  bbs.insert(bbs.begin() + b + 1, clones.begin(), clones.end());
+  bbs.insert(bbs.begin() + b + 1 + clones.size(), rest);
+}
+
+int RunInline(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  static int site_num = 0; // 复制出的基本块名字的前缀, 保证同一个函数里不重名
+  CallGraph cg = BuildCallGraph(program);
+  int n = cg.funcs.size();
+  std::vector<int> sizes(n);
+  std::vector<bool> supported(n);
+  int unit_size = 0;
+  for (int f = 0; f < n; ++f)
+  {
+    sizes[f] = IRFunctionSize(cg.funcs[f]);
+    supported[f] = IRSupported(cg.funcs[f]);
+    unit_size += sizes[f];
+  }
+  int budget = std::max(unit_size * inline_growth_percent / 100, inline_min_growth);
+  int growth = 0, changes = 0;
+
+  for (int f : cg.order)
+  {
+    koopa_raw_function_t func = cg.funcs[f];
+    if (!supported[f])
+      continue;
+    std::vector<koopa_raw_basic_block_t> bbs;
+    for (size_t k = 0; k < func->bbs.len; ++k)
+      bbs.push_back(IRBlock(func->bbs, k));
+    std::vector<const void *> entry_allocs;
+    int inlined = 0, before = sizes[f];
+    // 从后往前处理原有的调用点, 内联插入的基本块和前面调用点的位置互不影响.
+    // 内联进来的调用在处理被调用函数时已经考虑过, 不再看
+    for (size_t b = bbs.size(); b-- > 0;)
+      for (uint32_t i = bbs[b]->insts.len; i-- > 0;)
+      {
+        koopa_raw_value_t inst = IRValue(bbs[b]->insts, i);
+        if (inst->kind.tag != KOOPA_RVT_CALL)
+          continue;
+        auto it = cg.ids.find(inst->kind.data.call.callee);
+        if (it == cg.ids.end())
+          continue;
+        int g = it->second;
+        if (cg.scc[g] == cg.scc[f] || !supported[g])
+          continue;
+        const auto &args = inst->kind.data.call.args;
+        int consts = 0;
+        for (size_t k = 0; k < args.len; ++k)
+          consts += IRValue(args, k)->kind.tag == KOOPA_RVT_INTEGER;
+        int cost = sizes[g] - 1 - (int)args.len - inline_const_arg_bonus * consts;
+        if (cost > inline_threshold || growth + sizes[g] > budget)
+          continue;
+        InlineCallSite(bbs, b, i, site_num++, entry_allocs);
+        growth += sizes[g];
+        inlined++;
+      }
+    if (inlined == 0)
+      continue;
+    entry_allocs.insert(entry_allocs.end(), bbs[0]->insts.buffer, bbs[0]->insts.buffer + bbs[0]->insts.len);
+    Mut(bbs[0])->insts = IRSlice(entry_allocs, KOOPA_RSIK_VALUE);
+    Mut(func)->bbs = IRSlice(std::vector<const void *>(bbs.begin(), bbs.end()), KOOPA_RSIK_BASIC_BLOCK);
+    sizes[f] = IRFunctionSize(func);
+    changes += inlined;
+    if (time_enabled)
+      std::cerr << "[inline] " << func->name + 1 << " " << inlined << " +" << sizes[f] - before << std::endl;
+  }
+  return changes;
+}
@@ -0,0 +1,414 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+
+// Koopa IR 解释器 (-interp 模式), 直接执行内存中的 raw program
+// 先把每个函数翻译成紧凑的指令数组: 常量, 参数, 指令的结果和 alloc 出来的变量
+// 都被编号成栈帧里连续的槽位, 于是每条指令的操作数都只是一个槽位下标.
+// 常量在进入函数时一次性拷进栈帧, 执行时不再区分操作数的种类
+
+// 前 17 个和 koopa_raw_binary_op_t 的顺序一致, 可以直接转换
+enum InterpOp : uint8_t
+{
+  I_NE, I_EQ, I_GT, I_LT, I_GE, I_LE,
+  I_ADD, I_SUB, I_MUL, I_DIV, I_MOD,
+  I_AND, I_OR, I_XOR, I_SHL, I_SHR, I_SAR,
+  I_MOV,    // s[dst] = s[a], 局部变量的 load/store
+  I_LOADG,  // s[dst] = globals[a]
+  I_STOREG, // globals[dst] = s[a]
+  I_BR,     // s[a] ? pc = dst : pc = b
+  I_JUMP,   // pc = dst
+  I_CALL,   // s[dst] = call funcs[a], 参数槽位在 call_args[b] 开始的位置
+  I_RET,    // return s[a], a < 0 时没有返回值
+};
+
+struct InterpInst
+{
+  InterpOp op;
+  int32_t dst;
+  int32_t a;
+  int32_t b;
+};
+
+struct InterpFunc
+{
+  std::string name;
+  std::vector<InterpInst> code;
+  std::vector<int32_t> consts; // 栈帧开头的常量
+  std::vector<int32_t> call_args; // 每次调用: 参数个数, 然后是参数槽位
+  int num_params = 0;
+  int frame_size = 0;
+  bool is_decl = false;
+  // -fprofile-generate 用: 基本块的名字, 所有跳转的边 (起点和终点的块下标),
+  // 以及每条 br/jump 指令 (按 pc) 的第一条边, br 的 false 分支是下一条
+  std::vector<std::string> block_names;
+  std::vector<std::pair<int, int>> edges;
+  std::vector<int32_t> edge_of;
+};
+
+std::vector<InterpFunc> interp_funcs;
+std::vector<int32_t> interp_globals;
+// 栈只分配一次且不清零, 只有用到的页才会真正占用内存
+const size_t interp_stack_size = 1 << 22;
+std::unique_ptr<int32_t[]> interp_stack;
+size_t interp_sp = 0;
+uint64_t interp_inst_count = 0; // 执行过的指令条数
+// -fprofile-generate: 统计每个函数被调用的次数和每条边经过的次数, 写成 -fprofile-use 的格式 (见 Profile.hpp)
+bool interp_profile = false;
+std::vector<uint64_t> interp_call_counts;
+std::vector<std::vector<uint64_t>> interp_edge_counts;
+std::unordered_map<koopa_raw_function_t, int> interp_func_ids;
+std::unordered_map<koopa_raw_value_t, int> interp_global_ids;
+
+[[noreturn]] void InterpError(const std::string &msg)
+{
+  std::cerr << "interp: " << msg << std::endl;
+  exit(1);
+}
+
+// 把一个函数翻译成 InterpFunc
+void InterpTranslate(const koopa_raw_function_t &func, InterpFunc &f)
+{
+  f.name = func->name + 1;
+  f.num_params = func->params.len;
+  f.is_decl = func->bbs.len == 0;
+  if (f.is_decl)
+    return;
+
+  std::unordered_map<int32_t, int> const_slots;
+  std::unordered_map<koopa_raw_basic_block_t, int> block_pc;
+  std::unordered_map<koopa_raw_basic_block_t, int> block_index;
+  std::vector<koopa_raw_value_t> values;
+
+  // 第一遍: 给参数, 指令结果和 alloc 编号, 记录每个基本块的起始位置
+  for (size_t i = 0; i < func->params.len; ++i)
+    values.push_back(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]));
+  int pc = 0;
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    block_pc[bb] = pc;
+    block_index[bb] = i;
+    f.block_names.push_back(bb->name + 1);
+    for (size_t j = 0; j < bb->insts.len; ++j)
+    {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if (inst->ty->tag != KOOPA_RTT_UNIT)
+        values.push_back(inst);
+      if (inst->kind.tag != KOOPA_RVT_ALLOC)
+        pc++;
+    }
+  }
+
+  // 常量的槽位在最前面, 需要先扫一遍所有操作数
+  auto constant = [&](koopa_raw_value_t value) {
+    int32_t imm;
+    if (value->kind.tag == KOOPA_RVT_INTEGER)
+      imm = value->kind.data.integer.value;
+    else if (value->kind.tag == KOOPA_RVT_ZERO_INIT || value->kind.tag == KOOPA_RVT_UNDEF)
+      imm = 0;
+    else
+      return;
+    if (const_slots.count(imm))
+      return;
+    const_slots[imm] = f.consts.size();
+    f.consts.push_back(imm);
+  };
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j)
+    {
+      const auto &kind = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])->kind;
+      switch (kind.tag)
+      {
+      case KOOPA_RVT_BINARY:
+        constant(kind.data.binary.lhs);
+        constant(kind.data.binary.rhs);
+        break;
+      case KOOPA_RVT_STORE:
+        constant(kind.data.store.value);
+        break;
+      case KOOPA_RVT_BRANCH:
+        constant(kind.data.branch.cond);
+        break;
+      case KOOPA_RVT_CALL:
+        for (size_t k = 0; k < kind.data.call.args.len; ++k)
+          constant(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[k]));
+        break;
+      case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+          constant(kind.data.ret.value);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  // 常量之后依次是参数和指令结果
+  int next = f.consts.size();
+  std::unordered_map<koopa_raw_value_t, int> value_slots;
+  for (auto value : values)
+    value_slots[value] = next++;
+  f.frame_size = next;
+
+  auto slot = [&](koopa_raw_value_t value) -> int {
+    auto it = value_slots.find(value);
+    if (it != value_slots.end())
+      return it->second;
+    if (value->kind.tag == KOOPA_RVT_INTEGER)
+      return const_slots.at(value->kind.data.integer.value);
+    if (value->kind.tag == KOOPA_RVT_ZERO_INIT || value->kind.tag == KOOPA_RVT_UNDEF)
+      return const_slots.at(0);
+    InterpError("unsupported operand in @" + f.name);
+  };
+  auto global = [&](koopa_raw_value_t value) -> int {
+    auto it = interp_global_ids.find(value);
+    return it == interp_global_ids.end() ? -1 : it->second;
+  };
+
+  // 第二遍: 生成指令
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j)
+    {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      const auto &kind = inst->kind;
+      switch (kind.tag)
+      {
+      case KOOPA_RVT_ALLOC:
+        break;
+      case KOOPA_RVT_BINARY:
+        f.code.push_back({(InterpOp)kind.data.binary.op, slot(inst),
+                          slot(kind.data.binary.lhs), slot(kind.data.binary.rhs)});
+        break;
+      case KOOPA_RVT_LOAD:
+        if (global(kind.data.load.src) >= 0)
+          f.code.push_back({I_LOADG, slot(inst), global(kind.data.load.src), 0});
+        else
+          f.code.push_back({I_MOV, slot(inst), slot(kind.data.load.src), 0});
+        break;
+      case KOOPA_RVT_STORE:
+        if (global(kind.data.store.dest) >= 0)
+          f.code.push_back({I_STOREG, global(kind.data.store.dest), slot(kind.data.store.value), 0});
+        else
+          f.code.push_back({I_MOV, slot(kind.data.store.dest), slot(kind.data.store.value), 0});
+        break;
+      case KOOPA_RVT_BRANCH:
+        f.edge_of.resize(f.code.size());
+        f.edge_of.push_back(f.edges.size());
+        f.edges.push_back({i, block_index.at(kind.data.branch.true_bb)});
+        f.edges.push_back({i, block_index.at(kind.data.branch.false_bb)});
+        f.code.push_back({I_BR, block_pc.at(kind.data.branch.true_bb), slot(kind.data.branch.cond),
+                          block_pc.at(kind.data.branch.false_bb)});
+        break;
+      case KOOPA_RVT_JUMP:
+        f.edge_of.resize(f.code.size());
+        f.edge_of.push_back(f.edges.size());
+        f.edges.push_back({i, block_index.at(kind.data.jump.target)});
+        f.code.push_back({I_JUMP, block_pc.at(kind.data.jump.target), 0, 0});
+        break;
+      case KOOPA_RVT_CALL:
+      {
+        int args = f.call_args.size();
+        f.call_args.push_back(kind.data.call.args.len);
+        for (size_t k = 0; k < kind.data.call.args.len; ++k)
+          f.call_args.push_back(slot(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[k])));
+        int dst = inst->ty->tag == KOOPA_RTT_UNIT ? -1 : slot(inst);
+        f.code.push_back({I_CALL, dst, interp_func_ids.at(kind.data.call.callee), args});
+        break;
+      }
+      case KOOPA_RVT_RETURN:
+        f.code.push_back({I_RET, 0, kind.data.ret.value ? slot(kind.data.ret.value) : -1, 0});
+        break;
+      default:
+        InterpError("unsupported instruction in @" + f.name);
+      }
+    }
+  }
+}
+
+// 执行一个函数, args 是实参的值
+int32_t InterpRun(int func_id, const int32_t *args)
+{
+  const InterpFunc &f = interp_funcs[func_id];
+  if (f.is_decl)
+    InterpError("call to undefined function @" + f.name);
+  size_t base = interp_sp;
+  interp_sp += f.frame_size;
+  if (interp_sp > interp_stack_size)
+    InterpError("stack overflow in @" + f.name);
+  int32_t *s = interp_stack.get() + base;
+  int nconst = f.consts.size();
+  for (int i = 0; i < nconst; ++i)
+    s[i] = f.consts[i];
+  for (int i = 0; i < f.num_params; ++i)
+    s[nconst + i] = args[i];
+
+  const InterpInst *code = f.code.data();
+  int32_t *g = interp_globals.data();
+  uint64_t *edge_counts = nullptr;
+  if (interp_profile)
+  {
+    interp_call_counts[func_id]++;
+    edge_counts = interp_edge_counts[func_id].data();
+  }
+  uint64_t count = 0;
+  int pc = 0;
+  for (;;)
+  {
+    const InterpInst &inst = code[pc++];
+    count++;
+    switch (inst.op)
+    {
+    case I_NE: s[inst.dst] = s[inst.a] != s[inst.b]; break;
+    case I_EQ: s[inst.dst] = s[inst.a] == s[inst.b]; break;
+    case I_GT: s[inst.dst] = s[inst.a] > s[inst.b]; break;
+    case I_LT: s[inst.dst] = s[inst.a] < s[inst.b]; break;
+    case I_GE: s[inst.dst] = s[inst.a] >= s[inst.b]; break;
+    case I_LE: s[inst.dst] = s[inst.a] <= s[inst.b]; break;
+    // 用无符号运算实现 32 位回绕, 避免有符号溢出的未定义行为
+    case I_ADD: s[inst.dst] = (int32_t)((uint32_t)s[inst.a] + (uint32_t)s[inst.b]); break;
+    case I_SUB: s[inst.dst] = (int32_t)((uint32_t)s[inst.a] - (uint32_t)s[inst.b]); break;
+    case I_MUL: s[inst.dst] = (int32_t)((uint32_t)s[inst.a] * (uint32_t)s[inst.b]); break;
+    // 除法按 RISC-V 的规定处理除零和溢出, 保证和真机结果一致
+    case I_DIV:
+    {
+      int32_t l = s[inst.a], r = s[inst.b];
+      s[inst.dst] = r == 0 ? -1 : (l == INT32_MIN && r == -1) ? l : l / r;
+      break;
+    }
+    case I_MOD:
+    {
+      int32_t l = s[inst.a], r = s[inst.b];
+      s[inst.dst] = r == 0 ? l : (l == INT32_MIN && r == -1) ? 0 : l % r;
+      break;
+    }
+    case I_AND: s[inst.dst] = s[inst.a] & s[inst.b]; break;
+    case I_OR: s[inst.dst] = s[inst.a] | s[inst.b]; break;
+    case I_XOR: s[inst.dst] = s[inst.a] ^ s[inst.b]; break;
+    case I_SHL: s[inst.dst] = (int32_t)((uint32_t)s[inst.a] << (s[inst.b] & 31)); break;
+    case I_SHR: s[inst.dst] = (int32_t)((uint32_t)s[inst.a] >> (s[inst.b] & 31)); break;
+    case I_SAR: s[inst.dst] = s[inst.a] >> (s[inst.b] & 31); break;
+    case I_MOV: s[inst.dst] = s[inst.a]; break;
+    case I_LOADG: s[inst.dst] = g[inst.a]; break;
+    case I_STOREG: g[inst.dst] = s[inst.a]; break;
+    case I_BR:
+      if (edge_counts)
+        edge_counts[f.edge_of[pc - 1] + (s[inst.a] ? 0 : 1)]++;
+      pc = s[inst.a] ? inst.dst : inst.b;
+      break;
+    case I_JUMP:
+      if (edge_counts)
+        edge_counts[f.edge_of[pc - 1]]++;
+      pc = inst.dst;
+      break;
+    case I_CALL:
+    {
+      const int32_t *arg_slots = &f.call_args[inst.b];
+      int32_t nargs = arg_slots[0];
+      int32_t small_args[8];
+      std::vector<int32_t> large_args;
+      int32_t *arg_values = small_args;
+      if (nargs > 8)
+      {
+        large_args.resize(nargs);
+        arg_values = large_args.data();
+      }
+      for (int i = 0; i < nargs; ++i)
+        arg_values[i] = s[arg_slots[i + 1]];
+      interp_inst_count += count;
+      count = 0;
+      // interp_stack 预先分配好, 不会重新分配, s 在调用后仍然有效
+      int32_t ret = InterpRun(inst.a, arg_values);
+      if (inst.dst >= 0)
+        s[inst.dst] = ret;
+      break;
+    }
+    case I_RET:
+    {
+      int32_t ret = inst.a >= 0 ? s[inst.a] : 0;
+      interp_inst_count += count;
+      interp_sp = base;
+      return ret;
+    }
+    default:
+      assert(false);
+    }
+  }
+}
+
+// 解释执行整个程序, 返回 main 的返回值
+int32_t Interpret(const koopa_raw_program_t &program)
+{
+  interp_funcs.clear();
+  interp_globals.clear();
+  interp_func_ids.clear();
+  interp_global_ids.clear();
+  interp_inst_count = 0;
+  interp_sp = 0;
+  if (!interp_stack)
+    interp_stack.reset(new int32_t[interp_stack_size]);
+
+  for (size_t i = 0; i < program.values.len; ++i)
+  {
+    auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+    assert(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC);
+    auto init = value->kind.data.global_alloc.init;
+    interp_global_ids[value] = interp_globals.size();
+    interp_globals.push_back(init->kind.tag == KOOPA_RVT_INTEGER ? init->kind.data.integer.value : 0);
+  }
+  // 先给所有函数编号, 函数之间可以互相调用
+  int main_id = -1;
+  for (size_t i = 0; i < program.funcs.len; ++i)
+  {
+    auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+    interp_func_ids[func] = i;
+    if (std::string(func->name) == "@main")
+      main_id = i;
+  }
+  interp_funcs.resize(program.funcs.len);
+  for (size_t i = 0; i < program.funcs.len; ++i)
+    InterpTranslate(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]), interp_funcs[i]);
+  if (main_id < 0)
+    InterpError("no @main function");
+  interp_call_counts.assign(interp_funcs.size(), 0);
+  interp_edge_counts.clear();
+  for (auto &f : interp_funcs)
+    interp_edge_counts.emplace_back(f.edges.size());
+  return InterpRun(main_id, nullptr);
+}
+
+// 把 Interpret 统计的次数写成 -fprofile-use 的格式: 每个块的执行次数 (入口块是调用次数, 其余是进入它的边之和)
+// 和经过过的边. 写不了文件时返回 false
+bool InterpWriteProfile(const std::string &path)
+{
+  std::ofstream file(path);
+  file << "# profile generated by -interp -fprofile-generate\n";
+  for (size_t i = 0; i < interp_funcs.size(); ++i)
+  {
+    const InterpFunc &f = interp_funcs[i];
+    if (f.is_decl)
+      continue;
+    std::vector<uint64_t> blocks(f.block_names.size());
+    blocks[0] = interp_call_counts[i];
+    for (size_t e = 0; e < f.edges.size(); ++e)
+      blocks[f.edges[e].second] += interp_edge_counts[i][e];
+    for (size_t b = 0; b < blocks.size(); ++b)
+      file << "block " << f.name << " " << f.block_names[b] << " " << blocks[b] << "\n";
+    for (size_t e = 0; e < f.edges.size(); ++e)
+      if (interp_edge_counts[i][e] > 0)
+        file << "edge " << f.name << " " << f.block_names[f.edges[e].first] << " "
+             << f.block_names[f.edges[e].second] << " " << interp_edge_counts[i][e] << "\n";
+  }
+  return (bool)file;
+}
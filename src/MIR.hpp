@@ -0,0 +1,183 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "RVAsm.hpp"
+
+// 后端的机器 IR (MIR): 指令选择 (RISCV.hpp) 的结果, 寄存器分配前后的机器 pass 都在它上面工作
+// 每个函数是一串基本块, 每个基本块是一串 RVInst, 其中
+//   - 寄存器编号 0-31 是物理寄存器, 从 rv_vreg_base 开始是虚拟寄存器
+//   - 访问栈帧对象 (局部变量, 溢出的虚拟寄存器) 的指令用 RV_R_FRAME 标记, 偏移在 FinalizeFrame 中确定
+//   - li / la / call 是伪指令 (见 RVAsm.hpp), 写进 RVProgram 时才展开
+
+const int rv_vreg_base = 32;
+
+inline bool IsVReg(int reg)
+{
+  return reg >= rv_vreg_base;
+}
+
+struct MBlock
+{
+  std::string label;
+  int sym = -1; // 标签在 RVProgram 中的符号, 跳转指令用它引用这个块
+  std::vector<RVInst> insts;
+  std::vector<int> succs; // 后继基本块的下标
+  // 函数有 profile 时 (见 Profile.hpp) 这个块的执行次数, 以及到每个后继的次数 (和 succs 对应)
+  uint64_t count = 0;
+  std::vector<uint64_t> succ_counts;
+};
+
+struct MFunction
+{
+  std::string name;
+  std::vector<MBlock> blocks;     // blocks[0] 是入口
+  int vreg_num = rv_vreg_base;    // 下一个虚拟寄存器的编号
+  std::vector<int> frame_objects; // 每个栈帧对象的大小 (字节)
+  std::vector<int> saved_regs;    // 用到的 callee-saved 寄存器, 在 prologue/epilogue 中保存和恢复
+  std::vector<int> stack_params;  // 第 9 个起的参数在调用者栈帧底部, 对应的 (大小为 0 的) 栈帧对象
+  int outgoing_size = 0;          // 调用别的函数时放栈上参数的区域, 在栈帧最底部
+  bool has_call = false;          // 调用了别的函数, 要保存 ra
+  bool profiled = false;          // -fprofile-use 中有这个函数, 块上的次数有效
+  int frame_size = 0;             // 由 FinalizeFrame 确定
+
+  int NewVReg()
+  {
+    return vreg_num++;
+  }
+
+  int NewFrameObject(int size)
+  {
+    frame_objects.push_back(size);
+    return frame_objects.size() - 1;
+  }
+};
+
+// 指令写的寄存器, 没有时返回 -1
+inline int InstDef(const RVInst &inst)
+{
+  switch (rv_op_info[inst.op].format)
+  {
+  case 'S':
+  case 'B':
+    return -1;
+  default:
+    return inst.op == RV_ECALL || inst.op == RV_CALL ? -1 : inst.rd;
+  }
+}
+
+// 指令读的寄存器 (最多两个), 返回个数
+inline int InstUses(const RVInst &inst, int uses[2])
+{
+  switch (rv_op_info[inst.op].format)
+  {
+  case 'R':
+  case 'S':
+  case 'B':
+    uses[0] = inst.rs1;
+    uses[1] = inst.rs2;
+    return 2;
+  case 'I':
+  case 'H':
+    if (inst.op == RV_ECALL)
+      return 0;
+    uses[0] = inst.rs1;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// 除了写 rd 之外还有别的效果 (访存写, 控制流), 不能因为结果没用就删掉
+inline bool InstHasSideEffect(const RVInst &inst)
+{
+  char format = rv_op_info[inst.op].format;
+  return format == 'S' || format == 'B' || format == 'J' || inst.op == RV_JALR ||
+         inst.op == RV_ECALL || inst.op == RV_CALL;
+}
+
+// 有两地址压缩形式 (c.addi, c.add, c.and ...) 的运算
+inline bool IsTwoAddress(RVOp op)
+{
+  switch (op)
+  {
+  case RV_ADDI:
+  case RV_ANDI:
+  case RV_SLLI:
+  case RV_SRLI:
+  case RV_SRAI:
+  case RV_ADD:
+  case RV_SUB:
+  case RV_XOR:
+  case RV_OR:
+  case RV_AND:
+    return true;
+  default:
+    return false;
+  }
+}
+
+inline bool IsCommutative(RVOp op)
+{
+  return op == RV_ADD || op == RV_XOR || op == RV_OR || op == RV_AND || op == RV_MUL;
+}
+
+// 块的最后几条指令是跳转, 返回第一条跳转指令的下标
+inline size_t TerminatorStart(const MBlock &block)
+{
+  size_t i = block.insts.size();
+  while (i > 0)
+  {
+    const RVInst &inst = block.insts[i - 1];
+    if (rv_op_info[inst.op].format != 'B' && inst.op != RV_JAL && inst.op != RV_JALR)
+      break;
+    i--;
+  }
+  return i;
+}
+
+// 定长位集合, 用于按虚拟寄存器编号的数据流分析
+struct Bitset
+{
+  std::vector<uint64_t> words;
+
+  Bitset() {}
+  explicit Bitset(size_t n) : words((n + 63) / 64) {}
+
+  bool Test(size_t i) const
+  {
+    return words[i / 64] >> (i % 64) & 1;
+  }
+
+  void Set(size_t i)
+  {
+    words[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+
+  void Reset(size_t i)
+  {
+    words[i / 64] &= ~((uint64_t)1 << (i % 64));
+  }
+
+  // 并上另一个集合, 返回是否有变化
+  bool UnionWith(const Bitset &other)
+  {
+    bool changed = false;
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+      uint64_t word = words[i] | other.words[i];
+      changed |= word != words[i];
+      words[i] = word;
+    }
+    return changed;
+  }
+
+  // 依次访问集合中的元素
+  template <typename F>
+  void ForEach(F f) const
+  {
+    for (size_t i = 0; i < words.size(); ++i)
+      for (uint64_t word = words[i]; word; word &= word - 1)
+        f(i * 64 + __builtin_ctzll(word));
+  }
+};
@@ -0,0 +1,219 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "Analysis.hpp"
+#include "MIR.hpp"
+
+// MIR 上的优化 pass (寄存器分配之外的部分)
+
+// mdce: 删掉结果不再活跃, 也没有副作用的指令. 只看虚拟寄存器, 要在寄存器分配之前做
+int RunMachineDCE(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    const Liveness &live = am.GetLiveness(func);
+    for (size_t b = 0; b < func.blocks.size(); ++b)
+    {
+      auto &insts = func.blocks[b].insts;
+      Bitset alive = live.live_out[b];
+      std::vector<bool> dead(insts.size());
+      // 从后往前扫, 删掉的指令不会让它的操作数活跃
+      for (size_t i = insts.size(); i-- > 0;)
+      {
+        const RVInst &inst = insts[i];
+        int def = InstDef(inst);
+        if (def >= 0 && IsVReg(def))
+        {
+          if (!alive.Test(def - rv_vreg_base) && !InstHasSideEffect(inst))
+          {
+            dead[i] = true;
+            continue;
+          }
+          alive.Reset(def - rv_vreg_base);
+        }
+        int uses[2];
+        int k = InstUses(inst, uses);
+        for (int j = 0; j < k; ++j)
+          if (IsVReg(uses[j]))
+            alive.Set(uses[j] - rv_vreg_base);
+      }
+      size_t n = 0;
+      for (size_t i = 0; i < insts.size(); ++i)
+        if (!dead[i])
+          insts[n++] = insts[i];
+      changes += insts.size() - n;
+      insts.resize(n);
+    }
+  }
+  return changes;
+}
+
+inline bool IsMove(const RVInst &inst)
+{
+  return inst.op == RV_ADDI && inst.imm == 0 && inst.reloc == RV_R_NONE;
+}
+
+// peephole: 局部的小改写
+//   - 删掉 mv x, x 和写 x0 的无用指令
+//   - sw r, slot 紧跟着 lw r', slot: 换成 mv r', r (r' == r 时直接删掉)
+//   - 跳到下一个块的 j 删掉; bnez c, next; j other 改成 beqz c, other
+//   - -Os 时可交换的运算 rd == rs2 的交换操作数, 写成 rd == rs1 的两地址形式, 汇编器才会换成压缩指令
+int RunPeephole(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    for (size_t b = 0; b < func.blocks.size(); ++b)
+    {
+      auto &insts = func.blocks[b].insts;
+      std::vector<RVInst> out;
+      out.reserve(insts.size());
+      for (auto &inst : insts)
+      {
+        if ((IsMove(inst) && inst.rd == inst.rs1) || (inst.rd == RV_ZERO && InstDef(inst) == RV_ZERO && !InstHasSideEffect(inst)))
+        {
+          changes++;
+          continue;
+        }
+        if (rv_opt_size && IsCommutative(inst.op) && inst.rd == inst.rs2 && inst.rd != inst.rs1)
+        {
+          std::swap(inst.rs1, inst.rs2);
+          changes++;
+        }
+        if (inst.op == RV_LW && inst.reloc == RV_R_FRAME && !out.empty())
+        {
+          const RVInst &prev = out.back();
+          if (prev.op == RV_SW && prev.reloc == RV_R_FRAME && prev.sym == inst.sym && prev.imm == inst.imm)
+          {
+            changes++;
+            if (prev.rs2 != inst.rd)
+              out.push_back(RVInst(RV_ADDI, inst.rd, prev.rs2, 0, 0));
+            continue;
+          }
+        }
+        out.push_back(inst);
+      }
+      insts.swap(out);
+
+      // 跳转到紧跟着的下一个块
+      if (b + 1 == func.blocks.size() || insts.empty())
+        continue;
+      int next = func.blocks[b + 1].sym;
+      RVInst &last = insts.back();
+      if (last.op != RV_JAL || last.rd != RV_ZERO)
+        continue;
+      if (last.sym == next)
+      {
+        insts.pop_back();
+        changes++;
+        continue;
+      }
+      if (insts.size() >= 2)
+      {
+        RVInst &branch = insts[insts.size() - 2];
+        if ((branch.op == RV_BNE || branch.op == RV_BEQ) && branch.reloc == RV_R_BRANCH &&
+            branch.sym == next)
+        {
+          branch.op = branch.op == RV_BNE ? RV_BEQ : RV_BNE;
+          branch.sym = last.sym;
+          insts.pop_back();
+          changes++;
+        }
+      }
+    }
+  }
+  return changes;
+}
+
+// layout: 按 -fprofile-use 的执行次数重排基本块 (Pettis-Hansen), 让热的路径直接落下去, 不用跳转.
+// 从次数最大的边开始, 边 a -> b 的 a 是一条链的末尾, b 是另一条链的开头 (并且不是入口) 时把两条链接起来;
+// 最后入口所在的链放在最前面, 其余的链按开头的块的次数从大到小排列, 一样时保持原来的顺序.
+// 跳到下一个块的 j 之后由 peephole 删掉, 需要时把 bnez 反过来. 没有 profile 的函数不动.
+// -passes= 可以把 layout 放在 peephole 之后, 这时有的块已经没有 j, 直接落到原来的下一个块;
+// 重排后下一个块不是它时在块末补上 j
+int RunLayout(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    if (!func.profiled)
+      continue;
+    int n = func.blocks.size();
+    struct Edge
+    {
+      uint64_t count;
+      int from, to;
+    };
+    std::vector<Edge> edges;
+    for (int b = 0; b < n; ++b)
+      for (size_t k = 0; k < func.blocks[b].succs.size(); ++k)
+        if (func.blocks[b].succ_counts[k] > 0)
+          edges.push_back({func.blocks[b].succ_counts[k], b, func.blocks[b].succs[k]});
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b)
+                     { return a.count > b.count; });
+
+    // chains[c] 是一条链上依次的块, chain_of[b] 是块 b 所在的链
+    std::vector<std::vector<int>> chains(n);
+    std::vector<int> chain_of(n);
+    for (int b = 0; b < n; ++b)
+    {
+      chains[b] = {b};
+      chain_of[b] = b;
+    }
+    for (auto &edge : edges)
+    {
+      int from = chain_of[edge.from], to = chain_of[edge.to];
+      if (from == to || edge.to == 0 || chains[from].back() != edge.from || chains[to].front() != edge.to)
+        continue;
+      for (int b : chains[to])
+        chain_of[b] = from;
+      chains[from].insert(chains[from].end(), chains[to].begin(), chains[to].end());
+      chains[to].clear();
+    }
+
+    std::vector<int> heads;
+    for (int c = 0; c < n; ++c)
+      if (!chains[c].empty() && c != chain_of[0])
+        heads.push_back(c);
+    std::stable_sort(heads.begin(), heads.end(), [&](int a, int b)
+                     { return func.blocks[chains[a].front()].count > func.blocks[chains[b].front()].count; });
+    std::vector<int> order = chains[chain_of[0]];
+    for (int c : heads)
+      order.insert(order.end(), chains[c].begin(), chains[c].end());
+
+    std::vector<int> new_index(n);
+    int moved = 0;
+    for (int i = 0; i < n; ++i)
+    {
+      new_index[order[i]] = i;
+      moved += order[i] != i;
+    }
+    if (moved == 0)
+      continue;
+    // 最后一条不是 j 或 ret 的块会落到下一个块
+    std::vector<bool> falls(n);
+    std::vector<int> syms(n);
+    for (int b = 0; b < n; ++b)
+      syms[b] = func.blocks[b].sym;
+    for (int b = 0; b + 1 < n; ++b)
+    {
+      auto &insts = func.blocks[b].insts;
+      falls[b] = insts.empty() || !((insts.back().op == RV_JAL || insts.back().op == RV_JALR) && insts.back().rd == RV_ZERO);
+    }
+    std::vector<MBlock> blocks(n);
+    for (int i = 0; i < n; ++i)
+    {
+      int b = order[i];
+      blocks[i] = std::move(func.blocks[b]);
+      if (falls[b] && (i + 1 == n || order[i + 1] != b + 1))
+        blocks[i].insts.push_back(RVInst(RV_JAL, RV_ZERO, 0, 0, 0, RV_R_JAL, syms[b + 1]));
+      for (int &succ : blocks[i].succs)
+        succ = new_index[succ];
+    }
+    func.blocks.swap(blocks);
+    changes += moved;
+  }
+  return changes;
+}
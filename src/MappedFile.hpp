@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 只读地把整个文件映射到内存, 不复制文件内容.
+// Data() 之后紧跟一个 '\0', 可以直接当 C 字符串交给 libkoopa:
+// 先映射一段比文件多一个字节的匿名内存 (全 0), 再把文件映射到它的开头,
+// 文件之后的部分 (包括文件长度正好是页大小整数倍时的下一页) 仍然是 0
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile()
+  {
+    if (base)
+      munmap(base, size + 1);
+  }
+
+  // 失败时返回 false
+  bool Open(const char *path)
+  {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+      close(fd);
+      return false;
+    }
+    size = st.st_size;
+    base = mmap(nullptr, size + 1, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = base != MAP_FAILED;
+    if (ok && size > 0)
+      ok = mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+    close(fd);
+    if (!ok)
+    {
+      if (base != MAP_FAILED)
+        munmap(base, size + 1);
+      base = nullptr;
+    }
+    return ok;
+  }
+
+  const char *Data() const { return (const char *)base; }
+  size_t Size() const { return size; }
+
+private:
+  void *base = nullptr;
+  size_t size = 0;
+};
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "AST.hpp"
+#include "SymTab.hpp"
+
+// 语法分析
+// flex 和 bison 都是可重入的 (见 sysy.l, sysy.y): lexer 的状态在 yyscan_t 里, parser 没有全局变量,
+// 每个线程带一个自己的 scanner 就可以同时解析.
+// 并行解析时先扫一遍源文件, 按大括号的深度找到顶层定义之间的边界, 把文件切成几块,
+// 每块在一个线程里解析成一个 CompUnit, 再按块的顺序交出其中的函数, 结果和串行解析的一样
+
+// 为什么不引用 sysy.tab.hpp 和 flex 生成的头文件呢? 因为它们不是我们自己写的, 而是生成出来的,
+// 你的代码编辑器/IDE 很可能找不到这些文件, 于是在这里直接声明要用到的函数
+typedef void *yyscan_t;
+struct yy_buffer_state;
+int yylex_init(yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+yy_buffer_state *yy_scan_bytes(const char *bytes, int len, yyscan_t scanner);
+int yyparse(std::unique_ptr<BaseAST> &ast, yyscan_t scanner);
+
+// 串行解析整个文件. 打不开文件或者有语法错误时返回 false
+inline bool ParseFile(const char *path, std::unique_ptr<BaseAST> &ast)
+{
+  FILE *in = fopen(path, "r");
+  if (!in)
+    return false;
+  yyscan_t scanner;
+  yylex_init(&scanner);
+  yyset_in(in, scanner);
+  int ret = yyparse(ast, scanner);
+  yylex_destroy(scanner);
+  fclose(in);
+  return ret == 0;
+}
+
+// 每个顶层定义 (函数体的 '}' 或者顶层的 ';') 结束的位置, 跳过注释.
+// 最后一个定义之后只剩空白和注释, 不算边界, 这样切出来的每一块都至少有一个定义
+inline std::vector<size_t> TopLevelBoundaries(const char *data, size_t size)
+{
+  std::vector<size_t> ends;
+  int depth = 0;
+  for (size_t i = 0; i < size; ++i)
+  {
+    char c = data[i];
+    if (c == '/' && i + 1 < size && data[i + 1] == '/')
+    {
+      while (i < size && data[i] != '\n')
+        ++i;
+    }
+    else if (c == '/' && i + 1 < size && data[i + 1] == '*')
+    {
+      i += 2;
+      while (i + 1 < size && !(data[i] == '*' && data[i + 1] == '/'))
+        ++i;
+      ++i;
+    }
+    else if (c == '{')
+      ++depth;
+    else if (c == '}' && --depth == 0)
+      ends.push_back(i + 1);
+    else if (c == ';' && depth == 0)
+      ends.push_back(i + 1);
+  }
+  if (!ends.empty())
+    ends.pop_back();
+  return ends;
+}
+
+// 把 data 在顶层边界处切成至多 jobs 块, 每块大小差不多, 各自在一个线程里解析.
+// 主线程按顺序等每一块解析完, 驻留它的标识符, 再把其中的函数依次交给 handle,
+// 所以 handle 处理前面的函数时后面的块还在解析. 有语法错误时返回 false
+inline bool ParseParallel(const char *data, size_t size, int jobs,
+                          const std::function<void(std::unique_ptr<BaseAST>)> &handle)
+{
+  struct Chunk
+  {
+    size_t begin, end;
+    std::unique_ptr<BaseAST> ast;
+    std::vector<DeferredSymbol> symbols;
+    int ret = 0;
+    std::thread thread;
+  };
+  std::vector<size_t> ends = TopLevelBoundaries(data, size);
+  std::vector<Chunk> chunks(1);
+  chunks[0].begin = 0;
+  for (size_t end : ends)
+    if (chunks.size() < (size_t)jobs && end >= size * chunks.size() / jobs)
+    {
+      chunks.back().end = end;
+      chunks.emplace_back();
+      chunks.back().begin = end;
+    }
+  chunks.back().end = size;
+
+  auto parse = [data](Chunk &chunk)
+  {
+    deferred_symbols = &chunk.symbols;
+    yyscan_t scanner;
+    yylex_init(&scanner);
+    yy_scan_bytes(data + chunk.begin, chunk.end - chunk.begin, scanner);
+    chunk.ret = yyparse(chunk.ast, scanner);
+    yylex_destroy(scanner);
+    deferred_symbols = nullptr;
+  };
+  for (auto &chunk : chunks)
+    chunk.thread = std::thread(parse, std::ref(chunk));
+
+  bool ok = true;
+  for (auto &chunk : chunks)
+  {
+    chunk.thread.join();
+    if (!ok || chunk.ret != 0)
+    {
+      ok = false;
+      continue;
+    }
+    // 和串行解析时驻留的顺序相同, 得到的 ID 也相同
+    for (auto &symbol : chunk.symbols)
+      *symbol.sym = symbol_interner.Intern(*symbol.name);
+    for (auto &func_def : static_cast<CompUnitAST *>(chunk.ast.get())->func_defs)
+      handle(std::move(func_def));
+    chunk.ast.reset();
+  }
+  return ok;
+}
@@ -0,0 +1,224 @@
+#pragma once
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Analysis.hpp"
+#include "Inline.hpp"
+#include "IROpt.hpp"
+#include "MIR.hpp"
+#include "MOpt.hpp"
+#include "RegAlloc.hpp"
+#include "Sched.hpp"
+#include "Simplify.hpp"
+#include "Timer.hpp"
+
+// pass 管理器
+// 每个 pass 有一个名字, 作用在 koopa raw program (IR pass) 或 MIR (机器 pass) 上, 返回改动的次数,
+// 并声明改动后哪些分析会失效. 没有改动时分析结果保留, 下一个 pass 可以直接用.
+// 选项:
+//   -O0, -O1, -O2      选择预设的流水线 (见 opt_pipelines), 默认 -O0
+//   -Os                优化代码大小: 和 -O2 一样但不调度, 并打开 rv_opt_size (见 RVAsm.hpp)
+//   -passes=a,b,c      显式指定要跑的 pass 和顺序
+//   -fsched, -fno-sched 打开/关闭指令调度, 不管流水线里有没有 sched (打开时放在寄存器分配之前)
+// 加上 -time 时, 最后在 stderr 输出每个 pass 的 "[pass] <名字> <毫秒> <改动次数>"
+// (边解析边编译时是所有函数的总和), 以及各分析实际计算的次数 "[analysis] <名字> <次数>"
+
+struct Pass
+{
+  const char *name;
+  bool machine;         // false: IR pass, true: 机器 pass
+  bool allocator;       // 寄存器分配器, 机器 pass 中必须恰好跑一个
+  unsigned invalidates; // 有改动时失效的分析 (AnalysisKind)
+  int (*run_ir)(koopa_raw_program_t &program, AnalysisManager &am);
+  int (*run_mir)(std::vector<MFunction> &funcs, AnalysisManager &am);
+};
+
+const Pass pass_list[] = {
+    {"inline", false, false, ANALYSIS_DOMINATORS, RunInline, nullptr},
+    {"simplify", false, false, 0, RunSimplify, nullptr},
+    {"dce", false, false, 0, RunDCE, nullptr},
+    {"load-forward", false, false, 0, RunLoadForward, nullptr},
+    {"sccp", false, false, ANALYSIS_DOMINATORS, RunSCCP, nullptr},
+    {"unreachable", false, false, ANALYSIS_DOMINATORS, RunUnreachable, nullptr},
+    {"mdce", true, false, ANALYSIS_LIVENESS, nullptr, RunMachineDCE},
+    {"sched", true, false, 0, nullptr, RunSchedule},
+    {"layout", true, false, ANALYSIS_LIVENESS, nullptr, RunLayout},
+    {"peephole", true, false, ANALYSIS_LIVENESS, nullptr, RunPeephole},
+    {"spill-all", true, true, ANALYSIS_LIVENESS, nullptr, RunSpillAll},
+    {"linear-scan", true, true, ANALYSIS_LIVENESS, nullptr, RunLinearScan},
+};
+
+const char *opt_pipelines[] = {
+    "spill-all",                                                                                // -O0
+    "simplify,dce,layout,linear-scan,peephole",                                                 // -O1
+    "inline,sccp,load-forward,simplify,dce,unreachable,mdce,sched,layout,linear-scan,peephole", // -O2
+    "inline,sccp,load-forward,simplify,dce,unreachable,mdce,layout,linear-scan,peephole",       // -Os
+};
+
+class PassManager
+{
+public:
+  PassManager()
+  {
+    SetPipeline(opt_pipelines[0]);
+  }
+
+  // 处理 -O, -Os, -passes= 和 -f[no-]sched 选项, 不是这些选项时返回 false
+  bool ParseOption(const std::string &option)
+  {
+    if (option == "-fsched" || option == "-fno-sched")
+    {
+      sched = option == "-fsched" ? 1 : 0;
+      return true;
+    }
+    if (option == "-O0" || option == "-O1" || option == "-O2" || option == "-Os")
+    {
+      rv_opt_size = option == "-Os";
+      SetPipeline(opt_pipelines[rv_opt_size ? 3 : option[2] - '0']);
+      return true;
+    }
+    if (option.rfind("-passes=", 0) == 0)
+    {
+      SetPipeline(option.substr(8));
+      return true;
+    }
+    return false;
+  }
+
+  // 流水线里有没有这个 pass
+  bool Enabled(const std::string &name) const
+  {
+    for (auto pass : pipeline)
+      if (name == pass->name)
+        return true;
+    return false;
+  }
+
+  // 每次调用处理的都是新的程序 (边解析边编译时每个函数一次), 分析结果不能沿用上一次的
+  void RunIR(koopa_raw_program_t &program)
+  {
+    am.Invalidate(ANALYSIS_ALL);
+    for (auto pass : pipeline)
+      if (!pass->machine)
+        Run(pass, [&]
+            { return pass->run_ir(program, am); });
+  }
+
+  void RunMachine(std::vector<MFunction> &funcs)
+  {
+    am.Invalidate(ANALYSIS_ALL);
+    for (auto pass : MachinePipeline())
+      Run(pass, [&]
+          { return pass->run_mir(funcs, am); });
+  }
+
+  // -time 时输出各 pass 的累计耗时和改动次数, 以及各分析的计算次数
+  void Report()
+  {
+    if (!time_enabled)
+      return;
+    for (auto &stat : stats)
+      std::cerr << "[pass] " << stat.pass->name << " " << stat.ms << " " << stat.changes << std::endl;
+    std::cerr << "[analysis] dominators " << am.dominators_computed << std::endl;
+    std::cerr << "[analysis] liveness " << am.liveness_computed << std::endl;
+  }
+
+private:
+  std::vector<const Pass *> pipeline;
+  int sched = -1; // -fsched: 1, -fno-sched: 0, 没有指定: -1
+  AnalysisManager am;
+
+  struct PassStat
+  {
+    const Pass *pass;
+    double ms;
+    int changes;
+  };
+  std::vector<PassStat> stats; // 按第一次运行的顺序
+
+  static const Pass *FindPass(const std::string &name)
+  {
+    for (auto &pass : pass_list)
+      if (name == pass.name)
+        return &pass;
+    return nullptr;
+  }
+
+  // 要跑的机器 pass: 按 -f[no-]sched 加上或去掉 sched, 没有分配器时最后用 spill-all 兜底
+  std::vector<const Pass *> MachinePipeline()
+  {
+    const Pass *sched_pass = FindPass("sched");
+    std::vector<const Pass *> passes;
+    bool allocated = false;
+    for (auto pass : pipeline)
+    {
+      if (!pass->machine || (sched >= 0 && pass == sched_pass))
+        continue;
+      if (pass->allocator)
+      {
+        if (allocated)
+        {
+          std::cerr << "Register allocator " << pass->name << " after another allocator" << std::endl;
+          exit(1);
+        }
+        if (sched == 1)
+          passes.push_back(sched_pass);
+        allocated = true;
+      }
+      passes.push_back(pass);
+    }
+    if (!allocated)
+    {
+      if (sched == 1)
+        passes.push_back(sched_pass);
+      passes.push_back(FindPass("spill-all"));
+    }
+    return passes;
+  }
+
+  void SetPipeline(const std::string &list)
+  {
+    pipeline.clear();
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+      size_t comma = list.find(',', pos);
+      if (comma == std::string::npos)
+        comma = list.size();
+      std::string name = list.substr(pos, comma - pos);
+      pos = comma + 1;
+      if (name.empty())
+        continue;
+      const Pass *found = FindPass(name);
+      if (!found)
+      {
+        std::cerr << "Unknown pass: " << name << std::endl;
+        exit(1);
+      }
+      pipeline.push_back(found);
+    }
+  }
+
+  template <typename F>
+  void Run(const Pass *pass, F run)
+  {
+    auto start = std::chrono::steady_clock::now();
+    int changes = run();
+    auto end = std::chrono::steady_clock::now();
+    if (changes > 0)
+      am.Invalidate(pass->invalidates);
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    for (auto &stat : stats)
+      if (stat.pass == pass)
+      {
+        stat.ms += ms;
+        stat.changes += changes;
+        return;
+      }
+    stats.push_back({pass, ms, changes});
+  }
+};
+
+PassManager pass_manager;
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// 执行频率 (-fprofile-use=<文件>), 给后端的基本块布局 (MOpt.hpp 的 layout) 和溢出代价 (RegAlloc.hpp) 用.
+// 文件是文本, 每行一条记录, 空行和 # 开头的行忽略:
+//   block <函数> <基本块> <执行次数>
+//   edge <函数> <起点> <终点> <经过的次数>
+// 名字不带 @ 和 %, 和 -interp -fprofile-generate=<文件> 输出的一样 (见 Interp.hpp).
+// 文件里没有的函数按没有 profile 处理; 有 profile 的函数里没出现的块和边次数为 0
+
+struct FunctionProfile
+{
+  std::unordered_map<std::string, uint64_t> blocks;
+  std::map<std::pair<std::string, std::string>, uint64_t> edges;
+
+  uint64_t Block(const std::string &block) const
+  {
+    auto it = blocks.find(block);
+    return it == blocks.end() ? 0 : it->second;
+  }
+
+  uint64_t Edge(const std::string &from, const std::string &to) const
+  {
+    auto it = edges.find({from, to});
+    return it == edges.end() ? 0 : it->second;
+  }
+};
+
+class Profile
+{
+public:
+  // 读不了文件或者格式不对时返回 false
+  bool Load(const std::string &path)
+  {
+    std::ifstream file(path);
+    if (!file)
+      return false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+      std::istringstream in(line);
+      std::string kind, func, from, to;
+      uint64_t count;
+      if (!(in >> kind) || kind[0] == '#')
+        continue;
+      if (kind == "block" && in >> func >> from >> count)
+        funcs[func].blocks[from] += count;
+      else if (kind == "edge" && in >> func >> from >> to >> count)
+        funcs[func].edges[{from, to}] += count;
+      else
+        return false;
+    }
+    return true;
+  }
+
+  // 没有这个函数的 profile 时返回 nullptr
+  const FunctionProfile *Find(const std::string &func) const
+  {
+    auto it = funcs.find(func);
+    return it == funcs.end() ? nullptr : &it->second;
+  }
+
+private:
+  std::unordered_map<std::string, FunctionProfile> funcs;
+};
+
+// -fprofile-use 读进来的 profile, 没有指定时是空的
+Profile profile_use;
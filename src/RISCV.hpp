@@ -1,24 +1,37 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <cassert>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include "koopa.h"
+#include "MIR.hpp"
+#include "Pass.hpp"
+#include "Profile.hpp"
+#include "RVAsm.hpp"
+#include "Timer.hpp"
 
-struct register_t
-{
-  int reg_name;
-  int reg_num;
-};
 std::string reg_names[16] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6",
                              "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "x0"};
-koopa_raw_value_t registers[16];
-int reg_stats[16] = {0};
-koopa_raw_value_t present_value = 0;
-std::map<const koopa_raw_value_t, Reg> value_map;
-int stack_size = 0, stack_top = 0;
-std::map<uintptr_t, int> stack_frame;
-
+// 后端分三步:
+//   1. 指令选择: Visit 把 raw program 翻译成 MIR (见 MIR.hpp), 每个有返回值的指令得到一个虚拟寄存器,
+//      alloc 得到一个栈帧对象
+//   2. 机器 pass: 包括寄存器分配, 由 pass_manager 按 -O 级别调度 (见 Pass.hpp)
+//   3. 确定栈帧布局, 插入 prologue/epilogue, 写进 rv_program (见 RVAsm.hpp),
+//      由调用者决定打印成汇编还是写成目标文件
+RVProgram rv_program;
+std::vector<MFunction> mir_funcs;
+MFunction *cur_func = nullptr;                             // 正在生成的函数
+MBlock *cur_block = nullptr;                               // 正在生成的基本块
+std::unordered_map<koopa_raw_value_t, int> value_regs;     // 指令 -> 虚拟寄存器
+std::unordered_map<koopa_raw_value_t, int> frame_objects;  // alloc -> 栈帧对象
+std::unordered_map<koopa_raw_basic_block_t, int> block_ids; // 基本块 -> MBlock 下标
+int result_reg = 0;                                        // 当前指令的结果写到这个寄存器
+std::string func_name;                                     // 当前函数名, 用来给基本块标签加前缀
+const FunctionProfile *func_profile = nullptr;             // 当前函数的执行频率, 没有时为空
+koopa_raw_basic_block_t cur_bb = nullptr;                  // 正在生成的基本块
 
 void Visit(const koopa_raw_program_t &program);
 void Visit(const koopa_raw_slice_t &slice);
@@ -28,6 +41,71 @@ void Visit(const koopa_raw_value_t &value);
 void Visit(const koopa_raw_return_t &ret);
 void Visit(const koopa_raw_integer_t &integer);
 void Visit(const koopa_raw_binary_t &binary);
+void Visit(const koopa_raw_load_t &load);
+void Visit(const koopa_raw_store_t &store);
+void Visit(const koopa_raw_branch_t &branch);
+void Visit(const koopa_raw_jump_t &jump);
+void Visit(const koopa_raw_call_t &call);
+
+void Emit(RVOp op, int rd, int rs1, int rs2, int32_t imm = 0, RVReloc reloc = RV_R_NONE, int sym = -1)
+{
+  cur_block->insts.push_back(RVInst(op, rd, rs1, rs2, imm, reloc, sym));
+}
+
+// 指令结果所在的虚拟寄存器, 第一次用到时分配
+int ValueReg(const koopa_raw_value_t &value)
+{
+  auto it = value_regs.find(value);
+  if (it != value_regs.end())
+    return it->second;
+  return value_regs[value] = cur_func->NewVReg();
+}
+
+int FrameObject(const koopa_raw_value_t &alloc)
+{
+  auto it = frame_objects.find(alloc);
+  if (it != frame_objects.end())
+    return it->second;
+  return frame_objects[alloc] = cur_func->NewFrameObject(4);
+}
+
+// 把一个值放进寄存器, 返回寄存器编号. 常量 0 直接用 x0
+int LoadReg(const koopa_raw_value_t &value)
+{
+  int reg;
+  switch (value->kind.tag)
+  {
+  case KOOPA_RVT_INTEGER:
+    if (value->kind.data.integer.value == 0)
+      return RV_ZERO;
+    reg = cur_func->NewVReg();
+    Emit(RV_LI, reg, 0, 0, value->kind.data.integer.value);
+    return reg;
+  case KOOPA_RVT_GLOBAL_ALLOC:
+    reg = cur_func->NewVReg();
+    Emit(RV_LA, reg, 0, 0, 0, RV_R_NONE, rv_program.Symbol(value->name + 1));
+    return reg;
+  default:
+    return ValueReg(value);
+  }
+}
+
+// 能放进 12 位立即数的整数常量
+bool IsImm12(const koopa_raw_value_t &value)
+{
+  if (value->kind.tag != KOOPA_RVT_INTEGER)
+    return false;
+  int32_t imm = value->kind.data.integer.value;
+  return imm >= -2048 && imm <= 2047;
+}
+
+// 基本块对应的汇编标签 .L<函数>.<基本块>. 标识符里没有 '.', 所以不会和函数名, 全局变量名
+// 以及别的函数的块重名; .L 开头的是局部标签, 汇编器不放进符号表
+std::string BlockLabel(const koopa_raw_basic_block_t &bb)
+{
+  return ".L" + func_name + "." + (bb->name + 1);
+}
+
 /*
 typedef struct {
   /// Global values (global allocations only).
@@ -39,10 +117,10 @@ typedef struct {
 // 访问 raw program
 void Visit(const koopa_raw_program_t &program)
 {
-  // 执行一些其他的必要操作
-  std::cout << "\t.text" << std::endl;
   // 访问所有全局变量
+  rv_program.section = 1;
   Visit(program.values);
+  rv_program.section = 0;
   // 访问所有函数
   Visit(program.funcs);
 }
@@ -101,10 +179,45 @@ typedef struct {
 // 访问函数，函数里面是基本块
 void Visit(const koopa_raw_function_t &func)
 {
-  // 执行一些其他的必要操作
-  std::cout << "\t.globl " << func->name + 1 << std::endl;
-  if (fun->bbs.len == 0) return;
-  std::cout << func->name + 1 << ":\n";
+  // 函数声明没有基本块, 不生成代码
+  if (func->bbs.len == 0)
+    return;
+  func_name = func->name + 1;
+  func_profile = profile_use.Find(func_name);
+  mir_funcs.emplace_back();
+  cur_func = &mir_funcs.back();
+  cur_func->name = func_name;
+  cur_func->profiled = func_profile != nullptr;
+  value_regs.clear();
+  frame_objects.clear();
+  block_ids.clear();
+  // 先建好所有基本块, 跳转时才能找到目标
+  for (size_t i = 0; i < func->bbs.len; ++i)
+  {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    block_ids[bb] = i;
+    cur_func->blocks.emplace_back();
+    cur_func->blocks.back().label = BlockLabel(bb);
+    cur_func->blocks.back().sym = rv_program.Symbol(BlockLabel(bb));
+    if (func_profile)
+      cur_func->blocks.back().count = func_profile->Block(bb->name + 1);
+  }
+
+  // 参数: 前 8 个在 a0-a7, 其余的在调用者栈帧底部. 在入口处复制到虚拟寄存器
+  cur_block = &cur_func->blocks[0];
+  for (size_t i = 0; i < func->params.len; ++i)
+  {
+    auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+    int reg = ValueReg(param);
+    if (i < 8)
+      Emit(RV_ADDI, reg, RV_A0 + i, 0, 0);
+    else
+    {
+      int object = cur_func->NewFrameObject(0);
+      cur_func->stack_params.push_back(object);
+      Emit(RV_LW, reg, RV_SP, 0, 0, RV_R_FRAME, object);
+    }
+  }
 
   Visit(func->bbs); // 访问基本块
 }
@@ -124,11 +237,8 @@ typedef struct {
 // 访问基本块
 void Visit(const koopa_raw_basic_block_t &bb)
 {
-  int stack_s = cal_stack_s(bb->insts);
-  if (stack_s > 0){
-    std::cout << "\taddi sp, sp, -" << stack_s * 4 << std::endl;
-    
-  } 
+  cur_bb = bb;
+  cur_block = &cur_func->blocks[block_ids[bb]];
   Visit(bb->insts); // 访问指令
 }
 
@@ -174,8 +284,39 @@ void Visit(const koopa_raw_value_t &value)
     Visit(kind.data.integer);
     break;
   case KOOPA_RVT_BINARY:
+    result_reg = ValueReg(value);
     Visit(kind.data.binary);
     break;
+  case KOOPA_RVT_ALLOC:
+    // 在栈帧中占一个位置
+    FrameObject(value);
+    break;
+  case KOOPA_RVT_LOAD:
+    result_reg = ValueReg(value);
+    Visit(kind.data.load);
+    break;
+  case KOOPA_RVT_STORE:
+    Visit(kind.data.store);
+    break;
+  case KOOPA_RVT_BRANCH:
+    Visit(kind.data.branch);
+    break;
+  case KOOPA_RVT_JUMP:
+    Visit(kind.data.jump);
+    break;
+  case KOOPA_RVT_CALL:
+    // 没有返回值时 result_reg 为 -1
+    result_reg = value->ty->tag == KOOPA_RTT_UNIT ? -1 : ValueReg(value);
+    Visit(kind.data.call);
+    break;
+  case KOOPA_RVT_GLOBAL_ALLOC:
+    // 全局变量
+    rv_program.Label(value->name + 1, true, 'O');
+    if (kind.data.global_alloc.init->kind.tag == KOOPA_RVT_INTEGER)
+      rv_program.Word(kind.data.global_alloc.init->kind.data.integer.value);
+    else
+      rv_program.Zero(4);
+    break;
   default:
     assert(false);
   }
@@ -184,8 +325,15 @@ void Visit(const koopa_raw_value_t &value)
 void Visit(const koopa_raw_return_t &ret)
 {
   koopa_raw_value_t ret_value = ret.value;
-  Visit(ret_value);
-  std::cout << "  ret" << std::endl;
+  if (ret_value != nullptr)
+  {
+    if (ret_value->kind.tag == KOOPA_RVT_INTEGER)
+      Emit(RV_LI, RV_A0, 0, 0, ret_value->kind.data.integer.value);
+    else
+      Emit(RV_ADDI, RV_A0, LoadReg(ret_value), 0, 0);
+  }
+  // epilogue 在确定栈帧布局后插入到 ret 前面
+  Emit(RV_JALR, RV_ZERO, RV_RA, 0, 0);
 }
 /*
 typedef struct {
@@ -197,27 +345,231 @@ typedef struct {
   koopa_raw_value_t rhs;
 } koopa_raw_binary_t;
 */
+// 结果写到 result_reg. 右操作数是小常量时用立即数形式的指令
 void Visit(const koopa_raw_binary_t &binary)
 {
-  koopa_raw_value_t lhs = binary.lhs;
-  koopa_raw_value_t rhs = binary.rhs;
-  Visit(lhs);
-  Visit(rhs);
+  int rd = result_reg;
+  int32_t imm = binary.rhs->kind.tag == KOOPA_RVT_INTEGER ? binary.rhs->kind.data.integer.value : 0;
+  bool rhs_imm = IsImm12(binary.rhs);
+  int lhs = LoadReg(binary.lhs);
   switch (binary.op)
   {
-  case KOOPA_RBO_EQ: // ==
-    std::cout << " = eq " << std::endl;
-    break;
+  case KOOPA_RBO_NOT_EQ: // !=
+  case KOOPA_RBO_EQ:     // ==
+  {
+    int diff = lhs;
+    if (binary.rhs->kind.tag != KOOPA_RVT_INTEGER || imm != 0)
+    {
+      diff = cur_func->NewVReg();
+      if (rhs_imm)
+        Emit(RV_XORI, diff, lhs, 0, imm);
+      else
+        Emit(RV_XOR, diff, lhs, LoadReg(binary.rhs));
+    }
+    if (binary.op == KOOPA_RBO_NOT_EQ)
+      Emit(RV_SLTU, rd, RV_ZERO, diff); // snez
+    else
+      Emit(RV_SLTIU, rd, diff, 0, 1); // seqz
+    return;
+  }
+  case KOOPA_RBO_GT: // >
+    Emit(RV_SLT, rd, LoadReg(binary.rhs), lhs);
+    return;
+  case KOOPA_RBO_LT: // <
+    if (rhs_imm)
+      Emit(RV_SLTI, rd, lhs, 0, imm);
+    else
+      Emit(RV_SLT, rd, lhs, LoadReg(binary.rhs));
+    return;
+  case KOOPA_RBO_GE: // >=
+  case KOOPA_RBO_LE: // <=
+  {
+    int cmp = cur_func->NewVReg();
+    if (binary.op == KOOPA_RBO_GE && rhs_imm)
+      Emit(RV_SLTI, cmp, lhs, 0, imm);
+    else if (binary.op == KOOPA_RBO_GE)
+      Emit(RV_SLT, cmp, lhs, LoadReg(binary.rhs));
+    else
+      Emit(RV_SLT, cmp, LoadReg(binary.rhs), lhs);
+    Emit(RV_SLTIU, rd, cmp, 0, 1);
+    return;
+  }
+  case KOOPA_RBO_ADD: // +
+    if (rhs_imm)
+      Emit(RV_ADDI, rd, lhs, 0, imm);
+    else
+      Emit(RV_ADD, rd, lhs, LoadReg(binary.rhs));
+    return;
   case KOOPA_RBO_SUB: // -
-    std::cout << "\tsub   " << std::endl;
-    break;
+    if (rhs_imm && imm != -2048)
+      Emit(RV_ADDI, rd, lhs, 0, -imm);
+    else
+      Emit(RV_SUB, rd, lhs, LoadReg(binary.rhs));
+    return;
+  case KOOPA_RBO_AND: // &
+  case KOOPA_RBO_OR:  // |
+  case KOOPA_RBO_XOR: // ^
+  {
+    static const RVOp reg_ops[] = {RV_AND, RV_OR, RV_XOR}, imm_ops[] = {RV_ANDI, RV_ORI, RV_XORI};
+    int k = binary.op - KOOPA_RBO_AND;
+    if (rhs_imm)
+      Emit(imm_ops[k], rd, lhs, 0, imm);
+    else
+      Emit(reg_ops[k], rd, lhs, LoadReg(binary.rhs));
+    return;
+  }
+  case KOOPA_RBO_SHL: // <<
+  case KOOPA_RBO_SHR: // >> (逻辑)
+  case KOOPA_RBO_SAR: // >> (算术)
+  {
+    static const RVOp reg_ops[] = {RV_SLL, RV_SRL, RV_SRA}, imm_ops[] = {RV_SLLI, RV_SRLI, RV_SRAI};
+    int k = binary.op - KOOPA_RBO_SHL;
+    if (binary.rhs->kind.tag == KOOPA_RVT_INTEGER && imm >= 0 && imm < 32)
+      Emit(imm_ops[k], rd, lhs, 0, imm);
+    else
+      Emit(reg_ops[k], rd, lhs, LoadReg(binary.rhs));
+    return;
+  }
+  case KOOPA_RBO_MUL: // *
+    Emit(RV_MUL, rd, lhs, LoadReg(binary.rhs));
+    return;
+  case KOOPA_RBO_DIV: // /
+    Emit(RV_DIV, rd, lhs, LoadReg(binary.rhs));
+    return;
+  case KOOPA_RBO_MOD: // %
+    Emit(RV_REM, rd, lhs, LoadReg(binary.rhs));
+    return;
   default:
     assert(false);
   }
 }
 
+// 结果写到 result_reg
+void Visit(const koopa_raw_load_t &load)
+{
+  if (load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    Emit(RV_LW, result_reg, LoadReg(load.src), 0, 0);
+  else
+    Emit(RV_LW, result_reg, RV_SP, 0, 0, RV_R_FRAME, FrameObject(load.src));
+}
+
+void Visit(const koopa_raw_store_t &store)
+{
+  int value = LoadReg(store.value);
+  if (store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    Emit(RV_SW, 0, LoadReg(store.dest), value, 0);
+  else
+    Emit(RV_SW, 0, RV_SP, value, 0, RV_R_FRAME, FrameObject(store.dest));
+}
+
+// 从当前块到 target 的次数, 没有 profile 时为 0
+uint64_t EdgeCount(const koopa_raw_basic_block_t &target)
+{
+  return func_profile ? func_profile->Edge(cur_bb->name + 1, target->name + 1) : 0;
+}
+
+void Visit(const koopa_raw_branch_t &branch)
+{
+  int cond = LoadReg(branch.cond);
+  Emit(RV_BNE, 0, cond, RV_ZERO, 0, RV_R_BRANCH, cur_func->blocks[block_ids[branch.true_bb]].sym);
+  Emit(RV_JAL, RV_ZERO, 0, 0, 0, RV_R_JAL, cur_func->blocks[block_ids[branch.false_bb]].sym);
+  cur_block->succs = {block_ids[branch.true_bb], block_ids[branch.false_bb]};
+  cur_block->succ_counts = {EdgeCount(branch.true_bb), EdgeCount(branch.false_bb)};
+}
+
+void Visit(const koopa_raw_jump_t &jump)
+{
+  Emit(RV_JAL, RV_ZERO, 0, 0, 0, RV_R_JAL, cur_func->blocks[block_ids[jump.target]].sym);
+  cur_block->succs = {block_ids[jump.target]};
+  cur_block->succ_counts = {EdgeCount(jump.target)};
+}
+
+// 前 8 个实参放进 a0-a7, 其余的依次存到 sp 开始的栈上参数区, 返回值在 a0.
+// 调用前后不用保存寄存器: RegAlloc.hpp 的 FixedRanges 把 call 记成破坏所有 caller-saved 寄存器,
+// 跨过调用还活着的虚拟寄存器不会分到它们, 只能用 callee-saved 的 (由 prologue 保存) 或者溢出到栈上
+void Visit(const koopa_raw_call_t &call)
+{
+  int ret_reg = result_reg;
+  std::vector<int> regs;
+  for (size_t i = 0; i < call.args.len; ++i)
+  {
+    auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+    regs.push_back(i < 8 && arg->kind.tag == KOOPA_RVT_INTEGER ? -1 : LoadReg(arg));
+  }
+  for (size_t i = 0; i < regs.size(); ++i)
+  {
+    auto arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+    if (i >= 8)
+      Emit(RV_SW, 0, RV_SP, regs[i], 4 * (i - 8));
+    else if (regs[i] < 0)
+      Emit(RV_LI, RV_A0 + i, 0, 0, arg->kind.data.integer.value);
+    else
+      Emit(RV_ADDI, RV_A0 + i, regs[i], 0, 0);
+  }
+  if (regs.size() > 8)
+    cur_func->outgoing_size = std::max(cur_func->outgoing_size, 4 * ((int)regs.size() - 8));
+  Emit(RV_CALL, 0, 0, 0, 0, RV_R_NONE, rv_program.Symbol(call.callee->name + 1));
+  cur_func->has_call = true;
+  if (ret_reg >= 0)
+    Emit(RV_ADDI, ret_reg, RV_A0, 0, 0);
+}
+
 void Visit(const koopa_raw_integer_t &integer)
 {
   int32_t int_val = integer.value;
-  std::cout << "  li a0, " << int_val << std::endl;
-}
\ No newline at end of file
+  Emit(RV_LI, RV_A0, 0, 0, int_val);
+}
+
+// 把分配好寄存器, 确定了栈帧的函数写进 rv_program
+void EmitFunction(const MFunction &func)
+{
+  rv_program.Label(func.name, true, 'F');
+  for (auto &block : func.blocks)
+  {
+    rv_program.Label(block.label);
+    for (auto &inst : block.insts)
+      rv_program.Append(inst);
+  }
+}
+
+// 把 raw program 中的函数生成机器指令, 追加到 rv_program 中.
+// 边解析边编译时每个函数单独调用一次, MIR 用完就释放
+void AppendRISCV(const koopa_raw_program_t &program)
+{
+  {
+    PhaseTimer timer("isel");
+    Visit(program);
+  }
+  {
+    PhaseTimer timer("mopt");
+    pass_manager.RunMachine(mir_funcs);
+  }
+  {
+    PhaseTimer timer("lower");
+    for (auto &func : mir_funcs)
+    {
+      FinalizeFrame(func);
+      EmitFunction(func);
+    }
+  }
+  std::vector<MFunction>().swap(mir_funcs);
+}
+
+// 结束生成, 取出 rv_program 并清空它
+RVProgram FinishRISCV()
+{
+  RVProgram program = std::move(rv_program);
+  rv_program = RVProgram();
+  program.Finish();
+  if (rv_opt_size && time_enabled)
+    RVCReport(program, std::cerr);
+  return program;
+}
+
+// 生成整个程序的机器指令
+RVProgram GenerateRISCV(const koopa_raw_program_t &program)
+{
+  rv_program = RVProgram();
+  AppendRISCV(program);
+  return FinishRISCV();
+}
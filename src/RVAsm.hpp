@@ -0,0 +1,596 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// RV32IM 机器指令的表示
+// 后端 (RISCV.hpp) 直接生成 RVProgram, 伪指令 (li, la, call, bnez ...) 在生成时就展开成真正的指令,
+// 引用符号的指令记录重定位类型. 同一份 RVProgram 可以
+//   - 打印成汇编文本 (-riscv, PrintProgram)
+//   - 编码后写成 ELF 目标文件 (-obj, 见 ELF.hpp)
+//   - 在模拟器上运行 (-sim, 见 RVSim.hpp)
+
+enum RVOp : uint8_t
+{
+  RV_LUI, RV_AUIPC, RV_JAL, RV_JALR,
+  RV_BEQ, RV_BNE, RV_BLT, RV_BGE, RV_BLTU, RV_BGEU,
+  RV_LB, RV_LH, RV_LW, RV_LBU, RV_LHU,
+  RV_SB, RV_SH, RV_SW,
+  RV_ADDI, RV_SLTI, RV_SLTIU, RV_XORI, RV_ORI, RV_ANDI, RV_SLLI, RV_SRLI, RV_SRAI,
+  RV_ADD, RV_SUB, RV_SLL, RV_SLT, RV_SLTU, RV_XOR, RV_SRL, RV_SRA, RV_OR, RV_AND,
+  RV_MUL, RV_MULH, RV_MULHSU, RV_MULHU, RV_DIV, RV_DIVU, RV_REM, RV_REMU,
+  RV_ECALL,
+  // 伪指令, 只出现在后端的 MIR 中 (见 MIR.hpp), 写进 RVProgram 时展开
+  RV_LI, RV_LA, RV_CALL,
+  RV_OP_NUM
+};
+
+// 指令格式和编码字段, 格式: R I S B U J, 'H' 表示移位立即数的 I 型, 'P' 表示伪指令
+struct RVOpInfo
+{
+  const char *name;
+  char format;
+  uint8_t opcode;
+  uint8_t funct3;
+  uint8_t funct7;
+};
+
+const RVOpInfo rv_op_info[RV_OP_NUM] = {
+    {"lui", 'U', 0x37, 0, 0}, {"auipc", 'U', 0x17, 0, 0}, {"jal", 'J', 0x6f, 0, 0}, {"jalr", 'I', 0x67, 0, 0},
+    {"beq", 'B', 0x63, 0, 0}, {"bne", 'B', 0x63, 1, 0}, {"blt", 'B', 0x63, 4, 0},
+    {"bge", 'B', 0x63, 5, 0}, {"bltu", 'B', 0x63, 6, 0}, {"bgeu", 'B', 0x63, 7, 0},
+    {"lb", 'I', 0x03, 0, 0}, {"lh", 'I', 0x03, 1, 0}, {"lw", 'I', 0x03, 2, 0},
+    {"lbu", 'I', 0x03, 4, 0}, {"lhu", 'I', 0x03, 5, 0},
+    {"sb", 'S', 0x23, 0, 0}, {"sh", 'S', 0x23, 1, 0}, {"sw", 'S', 0x23, 2, 0},
+    {"addi", 'I', 0x13, 0, 0}, {"slti", 'I', 0x13, 2, 0}, {"sltiu", 'I', 0x13, 3, 0},
+    {"xori", 'I', 0x13, 4, 0}, {"ori", 'I', 0x13, 6, 0}, {"andi", 'I', 0x13, 7, 0},
+    {"slli", 'H', 0x13, 1, 0x00}, {"srli", 'H', 0x13, 5, 0x00}, {"srai", 'H', 0x13, 5, 0x20},
+    {"add", 'R', 0x33, 0, 0x00}, {"sub", 'R', 0x33, 0, 0x20}, {"sll", 'R', 0x33, 1, 0x00},
+    {"slt", 'R', 0x33, 2, 0x00}, {"sltu", 'R', 0x33, 3, 0x00}, {"xor", 'R', 0x33, 4, 0x00},
+    {"srl", 'R', 0x33, 5, 0x00}, {"sra", 'R', 0x33, 5, 0x20}, {"or", 'R', 0x33, 6, 0x00},
+    {"and", 'R', 0x33, 7, 0x00},
+    {"mul", 'R', 0x33, 0, 0x01}, {"mulh", 'R', 0x33, 1, 0x01}, {"mulhsu", 'R', 0x33, 2, 0x01},
+    {"mulhu", 'R', 0x33, 3, 0x01}, {"div", 'R', 0x33, 4, 0x01}, {"divu", 'R', 0x33, 5, 0x01},
+    {"rem", 'R', 0x33, 6, 0x01}, {"remu", 'R', 0x33, 7, 0x01},
+    {"ecall", 'I', 0x73, 0, 0},
+    {"li", 'P', 0, 0, 0}, {"la", 'P', 0, 0, 0}, {"call", 'P', 0, 0, 0},
+};
+
+// 指令中符号引用的方式
+enum RVReloc : uint8_t
+{
+  RV_R_NONE,
+  RV_R_BRANCH,       // B 型, 相对 pc
+  RV_R_JAL,          // J 型, 相对 pc
+  RV_R_CALL,         // auipc + jalr 组合, 记在 auipc 上
+  RV_R_PCREL_HI20,   // la 展开的 auipc
+  RV_R_PCREL_LO12_I, // la 展开的 addi, pair 指向对应的 auipc
+  RV_R_FRAME,        // MIR 中访问栈帧对象, sym 是对象编号, 确定栈帧布局后换成 sp 偏移
+};
+
+struct RVInst
+{
+  RVOp op = RV_ADDI;
+  int rd = 0, rs1 = 0, rs2 = 0; // MIR 中可以是虚拟寄存器
+  int32_t imm = 0;
+  RVReloc reloc = RV_R_NONE;
+  int sym = -1;  // 引用的符号
+  int pair = -1; // RV_R_PCREL_LO12_I 对应的 auipc 下标
+
+  RVInst() {}
+  RVInst(RVOp op, int rd, int rs1, int rs2, int32_t imm = 0, RVReloc reloc = RV_R_NONE, int sym = -1)
+      : op(op), rd(rd), rs1(rs1), rs2(rs2), imm(imm), reloc(reloc), sym(sym) {}
+};
+
+// 寄存器编号
+enum RVReg : uint8_t
+{
+  RV_ZERO, RV_RA, RV_SP, RV_GP, RV_TP, RV_T0, RV_T1, RV_T2,
+  RV_S0, RV_S1, RV_A0, RV_A1, RV_A2, RV_A3, RV_A4, RV_A5,
+  RV_A6, RV_A7, RV_S2, RV_S3, RV_S4, RV_S5, RV_S6, RV_S7,
+  RV_S8, RV_S9, RV_S10, RV_S11, RV_T3, RV_T4, RV_T5, RV_T6
+};
+
+const char *rv_abi_names[32] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+                                "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+                                "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+                                "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+// -Os: 目标有 C 扩展, 优化代码大小. 寄存器分配优先用 x8-x15 (见 RegAlloc.hpp),
+// 汇编里加上 .option rvc 让汇编器换成 16 位指令. 加上 -time 时在 stderr 输出每个函数估计的大小 (见 RVCReport)
+bool rv_opt_size = false;
+
+// 压缩指令的 3 位寄存器字段只能表示 x8-x15 (s0, s1, a0-a5)
+inline bool IsRVCReg(int reg)
+{
+  return reg >= RV_S0 && reg <= RV_A5;
+}
+
+struct RVSymbol
+{
+  std::string name;
+  int section = -1; // -1 未定义, 0 .text, 1 .data
+  uint32_t offset = 0;
+  uint32_t size = 0; // 函数/数据的大小, 由 Finish 计算
+  bool global = false;
+  char type = 0; // 'F' 函数, 'O' 数据, 0 普通标签
+};
+
+// .L 开头的局部标签 (基本块), 汇编器不放进符号表
+inline bool IsLocalLabel(const RVSymbol &sym)
+{
+  return sym.type == 0 && !sym.global && sym.name.compare(0, 2, ".L") == 0;
+}
+
+struct RVProgram
+{
+  std::vector<RVInst> text;
+  std::vector<uint8_t> data;
+  std::vector<RVSymbol> symbols;
+  std::map<std::string, int> symbol_ids;
+  int section = 0; // 正在生成的段
+
+  int Symbol(const std::string &name)
+  {
+    auto it = symbol_ids.find(name);
+    if (it != symbol_ids.end())
+      return it->second;
+    symbols.push_back({name});
+    return symbol_ids[name] = symbols.size() - 1;
+  }
+
+  // 在当前段的当前位置定义符号. 重复定义时报错退出
+  void Label(const std::string &name, bool global = false, char type = 0)
+  {
+    auto &sym = symbols[Symbol(name)];
+    if (sym.section >= 0)
+    {
+      std::cerr << "Symbol " << name << " is already defined" << std::endl;
+      exit(1);
+    }
+    sym.section = section;
+    sym.offset = section == 0 ? text.size() * 4 : data.size();
+    sym.global = global;
+    sym.type = type;
+  }
+
+  void Word(uint32_t word)
+  {
+    for (int i = 0; i < 4; ++i)
+      data.push_back(word >> (8 * i));
+  }
+
+  void Zero(size_t n)
+  {
+    data.resize(data.size() + n);
+  }
+
+  void Emit(RVOp op, int rd, int rs1, int rs2, int32_t imm = 0, RVReloc reloc = RV_R_NONE, int sym = -1)
+  {
+    assert(section == 0);
+    text.push_back(RVInst(op, rd, rs1, rs2, imm, reloc, sym));
+  }
+
+  // load/store: op reg, imm(base)
+  void Mem(RVOp op, int reg, int base, int32_t imm)
+  {
+    if (rv_op_info[op].format == 'S')
+      Emit(op, 0, base, reg, imm);
+    else
+      Emit(op, reg, base, 0, imm);
+  }
+
+  // 以下是伪指令, 展开方式和 GNU as / llvm-mc 相同, 保证打印出的汇编再汇编后得到一样的编码
+  void Li(int rd, int32_t imm)
+  {
+    if (imm >= -2048 && imm <= 2047)
+    {
+      Emit(RV_ADDI, rd, RV_ZERO, 0, imm);
+      return;
+    }
+    int32_t hi = (int32_t)(((uint32_t)imm + 0x800) >> 12);
+    int32_t lo = (int32_t)((uint32_t)imm - ((uint32_t)hi << 12));
+    Emit(RV_LUI, rd, 0, 0, hi & 0xfffff);
+    if (lo != 0)
+      Emit(RV_ADDI, rd, rd, 0, lo);
+  }
+
+  void La(int rd, const std::string &name)
+  {
+    int sym = Symbol(name);
+    Emit(RV_AUIPC, rd, 0, 0, 0, RV_R_PCREL_HI20, sym);
+    Emit(RV_ADDI, rd, rd, 0, 0, RV_R_PCREL_LO12_I, sym);
+    text.back().pair = text.size() - 2;
+  }
+
+  void Branch(RVOp op, int rs1, int rs2, const std::string &label)
+  {
+    Emit(op, 0, rs1, rs2, 0, RV_R_BRANCH, Symbol(label));
+  }
+
+  void J(const std::string &label)
+  {
+    Emit(RV_JAL, RV_ZERO, 0, 0, 0, RV_R_JAL, Symbol(label));
+  }
+
+  void Call(const std::string &name)
+  {
+    Emit(RV_AUIPC, RV_RA, 0, 0, 0, RV_R_CALL, Symbol(name));
+    Emit(RV_JALR, RV_RA, RV_RA, 0, 0);
+  }
+
+  void Ret()
+  {
+    Emit(RV_JALR, RV_ZERO, RV_RA, 0, 0);
+  }
+
+  // 追加一条 MIR 指令, 展开其中的伪指令
+  void Append(const RVInst &inst)
+  {
+    assert(inst.reloc != RV_R_FRAME && inst.rd < 32 && inst.rs1 < 32 && inst.rs2 < 32);
+    switch (inst.op)
+    {
+    case RV_LI:
+      Li(inst.rd, inst.imm);
+      break;
+    case RV_LA:
+      La(inst.rd, symbols[inst.sym].name);
+      break;
+    case RV_CALL:
+      Call(symbols[inst.sym].name);
+      break;
+    default:
+      text.push_back(inst);
+    }
+  }
+
+  // 生成结束后调用: 函数和数据的大小延伸到同一段中下一个函数/数据 (或者段尾)
+  void Finish()
+  {
+    std::vector<std::pair<uint32_t, int>> starts[2];
+    for (size_t i = 0; i < symbols.size(); ++i)
+      if (symbols[i].section >= 0 && symbols[i].type != 0)
+        starts[symbols[i].section].push_back({symbols[i].offset, (int)i});
+    for (int s = 0; s < 2; ++s)
+    {
+      uint32_t end = s == 0 ? text.size() * 4 : data.size();
+      std::sort(starts[s].begin(), starts[s].end());
+      for (size_t i = 0; i < starts[s].size(); ++i)
+      {
+        uint32_t next = i + 1 < starts[s].size() ? starts[s][i + 1].first : end;
+        symbols[starts[s][i].second].size = next - starts[s][i].first;
+      }
+    }
+  }
+};
+
+// 指令编码, imm 是解析过重定位后的立即数
+uint32_t RVEncode(const RVInst &inst, int32_t imm)
+{
+  const RVOpInfo &info = rv_op_info[inst.op];
+  uint32_t u = (uint32_t)imm;
+  uint32_t code = info.opcode | (uint32_t)info.funct3 << 12;
+  switch (info.format)
+  {
+  case 'R':
+    return code | inst.rd << 7 | inst.rs1 << 15 | inst.rs2 << 20 | (uint32_t)info.funct7 << 25;
+  case 'H':
+    return code | inst.rd << 7 | inst.rs1 << 15 | (u & 31) << 20 | (uint32_t)info.funct7 << 25;
+  case 'I':
+    return code | inst.rd << 7 | inst.rs1 << 15 | (u & 0xfff) << 20;
+  case 'S':
+    return code | (u & 0x1f) << 7 | inst.rs1 << 15 | inst.rs2 << 20 | (u >> 5 & 0x7f) << 25;
+  case 'B':
+    return code | (u >> 11 & 1) << 7 | (u >> 1 & 0xf) << 8 | inst.rs1 << 15 | inst.rs2 << 20 |
+           (u >> 5 & 0x3f) << 25 | (u >> 12 & 1) << 31;
+  case 'U':
+    return info.opcode | inst.rd << 7 | (u & 0xfffff) << 12;
+  case 'J':
+    return info.opcode | inst.rd << 7 | (u >> 12 & 0xff) << 12 | (u >> 11 & 1) << 20 |
+           (u >> 1 & 0x3ff) << 21 | (u >> 20 & 1) << 31;
+  default:
+    assert(false);
+    return 0;
+  }
+}
+
+// 有 C 扩展时 text[i] 的长度: 能换成 RV32C 的 16 位指令时是 2, 否则是 4.
+// 跳转的距离按全部 4 字节计算, 压缩之后只会更近, 所以在范围内的一定能压缩
+inline int RVCSize(const RVProgram &program, size_t i)
+{
+  const RVInst &inst = program.text[i];
+  int32_t imm = inst.imm;
+  int rd = inst.rd, rs1 = inst.rs1, rs2 = inst.rs2;
+  auto near = [&](int32_t range)
+  {
+    const RVSymbol &sym = program.symbols[inst.sym];
+    int32_t offset = (int32_t)sym.offset - (int32_t)(i * 4);
+    return sym.section == 0 && offset >= -range && offset < range;
+  };
+  if (inst.reloc == RV_R_BRANCH)
+    return (inst.op == RV_BEQ || inst.op == RV_BNE) && rs2 == RV_ZERO && IsRVCReg(rs1) && near(256) ? 2 : 4;
+  if (inst.reloc == RV_R_JAL)
+    return (rd == RV_ZERO || rd == RV_RA) && near(2048) ? 2 : 4;
+  if (inst.reloc != RV_R_NONE)
+    return 4;
+  bool small = imm >= -32 && imm < 32;
+  bool compressed = false;
+  switch (inst.op)
+  {
+  case RV_LUI: // c.lui
+    compressed = rd != RV_ZERO && rd != RV_SP && imm != 0 && (imm < 32 || imm >= 0xfffe0);
+    break;
+  case RV_ADDI: // c.nop, c.li, c.mv, c.addi, c.addi16sp, c.addi4spn
+    compressed = (rd == RV_ZERO && rs1 == RV_ZERO && imm == 0) || (rd != RV_ZERO && rs1 == RV_ZERO && small) ||
+                 (rd != RV_ZERO && rs1 != RV_ZERO && imm == 0) || (rd != RV_ZERO && rd == rs1 && imm != 0 && small) ||
+                 (rd == RV_SP && rs1 == RV_SP && imm != 0 && imm % 16 == 0 && imm >= -512 && imm < 512) ||
+                 (IsRVCReg(rd) && rs1 == RV_SP && imm > 0 && imm % 4 == 0 && imm < 1024);
+    break;
+  case RV_ANDI:
+    compressed = IsRVCReg(rd) && rd == rs1 && small;
+    break;
+  case RV_SLLI:
+    compressed = rd != RV_ZERO && rd == rs1 && imm != 0;
+    break;
+  case RV_SRLI:
+  case RV_SRAI:
+    compressed = IsRVCReg(rd) && rd == rs1 && imm != 0;
+    break;
+  case RV_ADD: // c.add, c.mv
+    compressed = rd != RV_ZERO && rs2 != RV_ZERO && (rd == rs1 || rs1 == RV_ZERO || (rd == rs2 && rs1 != RV_ZERO));
+    break;
+  case RV_SUB:
+    compressed = IsRVCReg(rd) && rd == rs1 && IsRVCReg(rs2);
+    break;
+  case RV_XOR:
+  case RV_OR:
+  case RV_AND:
+    compressed = IsRVCReg(rd) && IsRVCReg(rs1) && IsRVCReg(rs2) && (rd == rs1 || rd == rs2);
+    break;
+  case RV_LW: // c.lwsp, c.lw
+    compressed = imm >= 0 && imm % 4 == 0 &&
+                 ((rs1 == RV_SP && rd != RV_ZERO && imm < 256) || (IsRVCReg(rd) && IsRVCReg(rs1) && imm < 128));
+    break;
+  case RV_SW: // c.swsp, c.sw
+    compressed = imm >= 0 && imm % 4 == 0 &&
+                 ((rs1 == RV_SP && imm < 256) || (IsRVCReg(rs1) && IsRVCReg(rs2) && imm < 128));
+    break;
+  case RV_JALR: // c.jr, c.jalr. call 展开的 auipc + jalr 不压缩
+    compressed = (rd == RV_ZERO || rd == RV_RA) && rs1 != RV_ZERO && imm == 0 &&
+                 !(i > 0 && program.text[i - 1].reloc == RV_R_CALL);
+    break;
+  default:
+    break;
+  }
+  return compressed ? 2 : 4;
+}
+
+// -Os -time 时在 stderr 输出每个函数估计的大小 "[size] <函数> <字节数> <不压缩的字节数> <压缩的指令数>/<指令数>".
+// 要在 Finish 之后调用 (需要函数的大小)
+void RVCReport(const RVProgram &program, std::ostream &out)
+{
+  for (auto &sym : program.symbols)
+  {
+    if (sym.section != 0 || sym.type != 'F')
+      continue;
+    int bytes = 0, compressed = 0, insts = sym.size / 4;
+    for (size_t i = sym.offset / 4; i < (sym.offset + sym.size) / 4; ++i)
+    {
+      int size = RVCSize(program, i);
+      bytes += size;
+      compressed += size == 2;
+    }
+    out << "[size] " << sym.name << " " << bytes << " " << sym.size << " " << compressed << "/" << insts << std::endl;
+  }
+}
+
+// 打印一条指令, 能写成伪指令的写成伪指令. 可能一次消耗两条指令 (call, la, 大立即数的 li)
+void PrintInst(const RVProgram &program, const std::vector<bool> &labeled, size_t &i, std::ostream &out)
+{
+  const RVInst &inst = program.text[i];
+  const RVOpInfo &info = rv_op_info[inst.op];
+  const char *rd = rv_abi_names[inst.rd], *rs1 = rv_abi_names[inst.rs1], *rs2 = rv_abi_names[inst.rs2];
+  const RVInst *next = i + 1 < program.text.size() && !labeled[i + 1] ? &program.text[i + 1] : nullptr;
+  std::string sym = inst.sym >= 0 ? program.symbols[inst.sym].name : "";
+  out << "\t";
+  switch (inst.op)
+  {
+  case RV_AUIPC:
+    if (inst.reloc == RV_R_CALL)
+    {
+      out << "call " << sym << "\n";
+      i++;
+      return;
+    }
+    if (inst.reloc == RV_R_PCREL_HI20)
+    {
+      assert(next && next->reloc == RV_R_PCREL_LO12_I);
+      out << "la " << rd << ", " << sym << "\n";
+      i++;
+      return;
+    }
+    break;
+  case RV_LUI:
+    if (next && next->op == RV_ADDI && next->reloc == RV_R_NONE && next->rd == inst.rd && next->rs1 == inst.rd)
+    {
+      out << "li " << rd << ", " << (int32_t)(((uint32_t)inst.imm << 12) + (uint32_t)next->imm) << "\n";
+      i++;
+      return;
+    }
+    out << "li " << rd << ", " << (int32_t)((uint32_t)inst.imm << 12) << "\n";
+    return;
+  case RV_ADDI:
+    if (inst.rs1 == RV_ZERO && inst.rd != RV_ZERO)
+    {
+      out << "li " << rd << ", " << inst.imm << "\n";
+      return;
+    }
+    if (inst.imm == 0)
+    {
+      if (inst.rd == RV_ZERO && inst.rs1 == RV_ZERO)
+        out << "nop\n";
+      else
+        out << "mv " << rd << ", " << rs1 << "\n";
+      return;
+    }
+    break;
+  case RV_XORI:
+    if (inst.imm == -1)
+    {
+      out << "not " << rd << ", " << rs1 << "\n";
+      return;
+    }
+    break;
+  case RV_SLTIU:
+    if (inst.imm == 1)
+    {
+      out << "seqz " << rd << ", " << rs1 << "\n";
+      return;
+    }
+    break;
+  case RV_SLTU:
+    if (inst.rs1 == RV_ZERO)
+    {
+      out << "snez " << rd << ", " << rs2 << "\n";
+      return;
+    }
+    break;
+  case RV_SUB:
+    if (inst.rs1 == RV_ZERO)
+    {
+      out << "neg " << rd << ", " << rs2 << "\n";
+      return;
+    }
+    break;
+  case RV_JAL:
+    if (inst.rd == RV_ZERO)
+      out << "j " << sym << "\n";
+    else
+      out << "jal " << rd << ", " << sym << "\n";
+    return;
+  case RV_JALR:
+    if (inst.rd == RV_ZERO && inst.rs1 == RV_RA && inst.imm == 0)
+      out << "ret\n";
+    else
+      out << "jalr " << rd << ", " << inst.imm << "(" << rs1 << ")\n";
+    return;
+  case RV_ECALL:
+    out << "ecall\n";
+    return;
+  default:
+    break;
+  }
+  switch (info.format)
+  {
+  case 'R':
+    out << info.name << " " << rd << ", " << rs1 << ", " << rs2 << "\n";
+    break;
+  case 'I':
+    if (inst.op >= RV_LB && inst.op <= RV_LHU)
+      out << info.name << " " << rd << ", " << inst.imm << "(" << rs1 << ")\n";
+    else
+      out << info.name << " " << rd << ", " << rs1 << ", " << inst.imm << "\n";
+    break;
+  case 'H':
+    out << info.name << " " << rd << ", " << rs1 << ", " << inst.imm << "\n";
+    break;
+  case 'S':
+    out << info.name << " " << rs2 << ", " << inst.imm << "(" << rs1 << ")\n";
+    break;
+  case 'B':
+    if (inst.rs2 == RV_ZERO && (inst.op == RV_BEQ || inst.op == RV_BNE))
+      out << (inst.op == RV_BEQ ? "beqz " : "bnez ") << rs1 << ", " << sym << "\n";
+    else
+      out << info.name << " " << rs1 << ", " << rs2 << ", " << sym << "\n";
+    break;
+  default:
+    out << info.name << " " << rd << ", " << inst.imm << "\n";
+  }
+}
+
+// 把程序打印成汇编文本 (-riscv 模式的输出)
+void PrintProgram(const RVProgram &program, std::ostream &out)
+{
+  // 每个位置上定义的符号
+  std::vector<std::vector<int>> text_labels(program.text.size() + 1);
+  std::vector<int> data_labels;
+  for (size_t i = 0; i < program.symbols.size(); ++i)
+  {
+    const RVSymbol &sym = program.symbols[i];
+    if (sym.section == 0)
+      text_labels[sym.offset / 4].push_back(i);
+    else if (sym.section == 1)
+      data_labels.push_back(i);
+  }
+  std::stable_sort(data_labels.begin(), data_labels.end(), [&](int a, int b)
+                   { return program.symbols[a].offset < program.symbols[b].offset; });
+  // 同一位置上函数名在前, 基本块的标签在后
+  for (auto &labels : text_labels)
+    std::stable_sort(labels.begin(), labels.end(), [&](int a, int b)
+                     { return program.symbols[a].type == 'F' && program.symbols[b].type != 'F'; });
+
+  auto header = [&](const RVSymbol &sym)
+  {
+    if (sym.global)
+      out << "\t.globl " << sym.name << "\n";
+    if (sym.type)
+      out << "\t.type " << sym.name << ", " << (sym.type == 'F' ? "@function" : "@object") << "\n";
+    out << sym.name << ":\n";
+  };
+
+  if (!program.data.empty())
+  {
+    out << "\t.data\n";
+    for (size_t k = 0; k < data_labels.size(); ++k)
+    {
+      const RVSymbol &sym = program.symbols[data_labels[k]];
+      header(sym);
+      uint32_t end = k + 1 < data_labels.size() ? program.symbols[data_labels[k + 1]].offset : program.data.size();
+      // 全零的部分用 .zero, 其余按字输出
+      bool zero = std::all_of(program.data.begin() + sym.offset, program.data.begin() + end, [](uint8_t b)
+                              { return b == 0; });
+      if (zero && end > sym.offset)
+        out << "\t.zero " << end - sym.offset << "\n";
+      else
+        for (uint32_t p = sym.offset; p + 4 <= end; p += 4)
+          out << "\t.word " << (int32_t)(program.data[p] | program.data[p + 1] << 8 | program.data[p + 2] << 16 |
+                                        (uint32_t)program.data[p + 3] << 24)
+              << "\n";
+      if (sym.type)
+        out << "\t.size " << sym.name << ", " << sym.size << "\n";
+    }
+    out << "\n";
+  }
+
+  out << "\t.text\n";
+  if (rv_opt_size)
+    out << "\t.option rvc\n";
+  std::vector<bool> labeled(program.text.size() + 1);
+  for (size_t i = 0; i <= program.text.size(); ++i)
+    labeled[i] = !text_labels[i].empty();
+  const RVSymbol *func = nullptr;
+  for (size_t i = 0; i <= program.text.size(); ++i)
+  {
+    for (int id : text_labels[i])
+    {
+      const RVSymbol &sym = program.symbols[id];
+      if (sym.type == 'F')
+      {
+        if (func)
+          out << "\t.size " << func->name << ", .-" << func->name << "\n\n";
+        func = &sym;
+      }
+      header(sym);
+    }
+    if (i == program.text.size())
+      break;
+    PrintInst(program, labeled, i, out);
+  }
+  if (func)
+    out << "\t.size " << func->name << ", .-" << func->name << "\n";
+}
@@ -0,0 +1,330 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "RVAsm.hpp"
+
+// RV32IM 模拟器 (-sim 模式), 用来衡量生成代码的质量
+// 周期模型是一个简单的顺序流水线: 每周期最多发射一条指令,
+// 源寄存器的结果还没准备好时停顿 (load-use, mul/div 延迟), 跳转成功时加上惩罚
+
+struct RVCostModel
+{
+  int alu = 1;    // 普通运算指令的延迟
+  int load = 2;   // load 的延迟, 2 表示紧跟着使用会停顿 1 个周期
+  int mul = 3;    // mul 系列的延迟
+  int div = 20;   // div/rem 系列的延迟
+  int branch = 2; // 条件跳转成功时的惩罚
+  int jump = 1;   // jal/jalr 的惩罚
+};
+
+// 解析 -sim-cost=mul=3,div=20,...
+bool ParseCostModel(const std::string &spec, RVCostModel &cost)
+{
+  size_t pos = 0;
+  while (pos < spec.size())
+  {
+    size_t comma = spec.find(',', pos);
+    if (comma == std::string::npos)
+      comma = spec.size();
+    std::string item = spec.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    if (eq == std::string::npos)
+      return false;
+    std::string key = item.substr(0, eq);
+    int value = atoi(item.c_str() + eq + 1);
+    if (key == "alu")
+      cost.alu = value;
+    else if (key == "load")
+      cost.load = value;
+    else if (key == "mul")
+      cost.mul = value;
+    else if (key == "div")
+      cost.div = value;
+    else if (key == "branch")
+      cost.branch = value;
+    else if (key == "jump")
+      cost.jump = value;
+    else
+      return false;
+    pos = comma + 1;
+  }
+  return true;
+}
+
+// -sim-cost 设置的周期模型, 模拟器和指令调度 (Sched.hpp) 共用
+RVCostModel rv_cost_model;
+
+// 指令结果的延迟, 和模拟器中的计算一致
+int RVLatency(const RVCostModel &cost, int op)
+{
+  switch (op)
+  {
+  case RV_LB: case RV_LH: case RV_LW: case RV_LBU: case RV_LHU:
+    return cost.load;
+  case RV_MUL: case RV_MULH: case RV_MULHSU: case RV_MULHU:
+    return cost.mul;
+  case RV_DIV: case RV_DIVU: case RV_REM: case RV_REMU:
+    return cost.div;
+  default:
+    return cost.alu;
+  }
+}
+
+struct RVFuncStats
+{
+  std::string name;
+  uint64_t insts = 0;
+  uint64_t cycles = 0;
+};
+
+struct RVSimResult
+{
+  int32_t ret = 0;
+  uint64_t insts = 0;
+  uint64_t cycles = 0;
+  std::vector<RVFuncStats> funcs; // 每个函数自身 (不含调用的函数) 的统计
+};
+
+// 内存布局
+const uint32_t rv_text_base = 0x10000;
+const uint32_t rv_data_base = 0x100000;
+const uint32_t rv_mem_size = 0x1000000; // 16MB, 栈从顶部向下增长
+const uint32_t rv_exit_addr = 0x4;      // main 返回到这里时结束模拟
+
+class RVSimulator
+{
+public:
+  RVSimulator(const RVProgram &program, const RVCostModel &cost) : program(program), cost(cost) {}
+  ~RVSimulator() { free(mem); }
+
+  RVSimResult Run(const std::string &entry = "main")
+  {
+    Link();
+    auto it = program.symbol_ids.find(entry);
+    if (it == program.symbol_ids.end() || program.symbols[it->second].section != 0)
+      Error("no function " + entry);
+
+    // calloc 得到的大块内存按需清零, 不会一开始就占满 16MB
+    free(mem);
+    mem = (uint8_t *)calloc(rv_mem_size, 1);
+    memcpy(&mem[rv_data_base], program.data.data(), program.data.size());
+    memset(x, 0, sizeof(x));
+    x[1] = rv_exit_addr;
+    x[2] = rv_mem_size;
+    memset(ready, 0, sizeof(ready));
+
+    uint32_t pc = rv_text_base + program.symbols[it->second].offset;
+    uint64_t cycle = 0, insts = 0;
+    size_t n = text.size();
+    while (pc != rv_exit_addr)
+    {
+      size_t index = (pc - rv_text_base) / 4;
+      if (pc < rv_text_base || (pc & 3) || index >= n)
+        Error("pc out of range: " + std::to_string(pc));
+      const RVInst &inst = text[index];
+      // 等待源操作数就绪
+      uint64_t issue = cycle;
+      if (ready[inst.rs1] > issue)
+        issue = ready[inst.rs1];
+      if (ready[inst.rs2] > issue)
+        issue = ready[inst.rs2];
+      uint64_t next_cycle = issue + 1;
+      int latency = cost.alu;
+      uint32_t next_pc = pc + 4;
+      uint32_t a = x[inst.rs1], b = x[inst.rs2];
+      int32_t sa = (int32_t)a, sb = (int32_t)b;
+      uint32_t result = 0;
+      bool write = true;
+      switch (inst.op)
+      {
+      case RV_LUI: result = (uint32_t)inst.imm << 12; break;
+      case RV_AUIPC: result = pc + ((uint32_t)inst.imm << 12); break;
+      case RV_JAL:
+        result = pc + 4;
+        next_pc = pc + inst.imm;
+        next_cycle += cost.jump;
+        break;
+      case RV_JALR:
+        result = pc + 4;
+        next_pc = (a + inst.imm) & ~1u;
+        next_cycle += cost.jump;
+        break;
+      case RV_BEQ: case RV_BNE: case RV_BLT: case RV_BGE: case RV_BLTU: case RV_BGEU:
+      {
+        bool taken = inst.op == RV_BEQ ? a == b : inst.op == RV_BNE ? a != b
+                   : inst.op == RV_BLT ? sa < sb : inst.op == RV_BGE ? sa >= sb
+                   : inst.op == RV_BLTU ? a < b : a >= b;
+        if (taken)
+        {
+          next_pc = pc + inst.imm;
+          next_cycle += cost.branch;
+        }
+        write = false;
+        break;
+      }
+      case RV_LB: result = (int32_t)(int8_t)Load(a + inst.imm, 1); latency = cost.load; break;
+      case RV_LH: result = (int32_t)(int16_t)Load(a + inst.imm, 2); latency = cost.load; break;
+      case RV_LW: result = Load(a + inst.imm, 4); latency = cost.load; break;
+      case RV_LBU: result = Load(a + inst.imm, 1); latency = cost.load; break;
+      case RV_LHU: result = Load(a + inst.imm, 2); latency = cost.load; break;
+      case RV_SB: Store(a + inst.imm, b, 1); write = false; break;
+      case RV_SH: Store(a + inst.imm, b, 2); write = false; break;
+      case RV_SW: Store(a + inst.imm, b, 4); write = false; break;
+      case RV_ADDI: result = a + inst.imm; break;
+      case RV_SLTI: result = sa < inst.imm; break;
+      case RV_SLTIU: result = a < (uint32_t)inst.imm; break;
+      case RV_XORI: result = a ^ inst.imm; break;
+      case RV_ORI: result = a | inst.imm; break;
+      case RV_ANDI: result = a & inst.imm; break;
+      case RV_SLLI: result = a << inst.imm; break;
+      case RV_SRLI: result = a >> inst.imm; break;
+      case RV_SRAI: result = sa >> inst.imm; break;
+      case RV_ADD: result = a + b; break;
+      case RV_SUB: result = a - b; break;
+      case RV_SLL: result = a << (b & 31); break;
+      case RV_SLT: result = sa < sb; break;
+      case RV_SLTU: result = a < b; break;
+      case RV_XOR: result = a ^ b; break;
+      case RV_SRL: result = a >> (b & 31); break;
+      case RV_SRA: result = sa >> (b & 31); break;
+      case RV_OR: result = a | b; break;
+      case RV_AND: result = a & b; break;
+      case RV_MUL: result = a * b; latency = cost.mul; break;
+      case RV_MULH: result = (uint32_t)(((int64_t)sa * sb) >> 32); latency = cost.mul; break;
+      case RV_MULHSU: result = (uint32_t)(((int64_t)sa * (uint64_t)b) >> 32); latency = cost.mul; break;
+      case RV_MULHU: result = (uint32_t)(((uint64_t)a * b) >> 32); latency = cost.mul; break;
+      case RV_DIV:
+        result = b == 0 ? -1 : (sa == INT32_MIN && sb == -1) ? a : (uint32_t)(sa / sb);
+        latency = cost.div;
+        break;
+      case RV_DIVU: result = b == 0 ? UINT32_MAX : a / b; latency = cost.div; break;
+      case RV_REM:
+        result = b == 0 ? a : (sa == INT32_MIN && sb == -1) ? 0 : (uint32_t)(sa % sb);
+        latency = cost.div;
+        break;
+      case RV_REMU: result = b == 0 ? a : a % b; latency = cost.div; break;
+      case RV_ECALL: Error("ecall is not supported");
+      default: Error("bad instruction");
+      }
+      if (write && inst.rd != 0)
+      {
+        x[inst.rd] = result;
+        ready[inst.rd] = issue + latency;
+      }
+      stats[func_of[index]].insts++;
+      stats[func_of[index]].cycles += next_cycle - cycle;
+      cycle = next_cycle;
+      insts++;
+      pc = next_pc;
+    }
+
+    RVSimResult result;
+    result.ret = (int32_t)x[10];
+    result.insts = insts;
+    result.cycles = cycle;
+    for (auto &s : stats)
+      if (s.insts > 0)
+        result.funcs.push_back(s);
+    return result;
+  }
+
+private:
+  const RVProgram &program;
+  RVCostModel cost;
+  std::vector<RVInst> text; // 重定位解析完的指令
+  std::vector<int> func_of; // 指令属于哪个函数
+  std::vector<RVFuncStats> stats;
+  uint8_t *mem = nullptr;
+  uint32_t x[32];
+  uint64_t ready[32]; // 寄存器的值在哪个周期可用
+
+  [[noreturn]] void Error(const std::string &msg)
+  {
+    std::cerr << "sim: " << msg << std::endl;
+    exit(1);
+  }
+
+  uint32_t Address(int sym)
+  {
+    const RVSymbol &s = program.symbols[sym];
+    if (s.section < 0)
+      Error("undefined symbol " + s.name);
+    return (s.section == 0 ? rv_text_base : rv_data_base) + s.offset;
+  }
+
+  // 把符号引用解析成立即数, 同时找出每条指令所属的函数
+  void Link()
+  {
+    text = program.text;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+      RVInst &inst = text[i];
+      uint32_t pc = rv_text_base + i * 4;
+      switch (inst.reloc)
+      {
+      case RV_R_NONE:
+      case RV_R_FRAME: // 只在 MIR 中出现, RVProgram 里已经不存在
+        break;
+      case RV_R_BRANCH:
+      case RV_R_JAL:
+        inst.imm = Address(inst.sym) - pc;
+        break;
+      case RV_R_CALL:
+      case RV_R_PCREL_HI20:
+      {
+        int32_t offset = Address(inst.sym) - pc;
+        int32_t hi = (int32_t)(((uint32_t)offset + 0x800) >> 12);
+        inst.imm = hi & 0xfffff;
+        if (inst.reloc == RV_R_CALL)
+          text[i + 1].imm = offset - (int32_t)((uint32_t)hi << 12);
+        break;
+      }
+      case RV_R_PCREL_LO12_I:
+      {
+        uint32_t auipc_pc = rv_text_base + inst.pair * 4;
+        int32_t offset = Address(inst.sym) - auipc_pc;
+        int32_t hi = (int32_t)(((uint32_t)offset + 0x800) >> 12);
+        inst.imm = offset - (int32_t)((uint32_t)hi << 12);
+        break;
+      }
+      }
+    }
+
+    // 函数就是 .text 中的全局符号
+    std::vector<std::pair<uint32_t, std::string>> funcs;
+    for (auto &s : program.symbols)
+      if (s.section == 0 && s.global)
+        funcs.push_back({s.offset, s.name});
+    std::sort(funcs.begin(), funcs.end());
+    stats.assign(1, {"<none>"});
+    func_of.assign(text.size(), 0);
+    size_t f = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+      while (f < funcs.size() && funcs[f].first <= i * 4)
+        stats.push_back({funcs[f++].second});
+      func_of[i] = stats.size() - 1;
+    }
+  }
+
+  uint32_t Load(uint32_t addr, int size)
+  {
+    if (addr + size > rv_mem_size || addr < rv_data_base)
+      Error("load out of range: " + std::to_string(addr));
+    uint32_t v = 0;
+    memcpy(&v, &mem[addr], size);
+    return v;
+  }
+
+  void Store(uint32_t addr, uint32_t v, int size)
+  {
+    if (addr + size > rv_mem_size || addr < rv_data_base)
+      Error("store out of range: " + std::to_string(addr));
+    memcpy(&mem[addr], &v, size);
+  }
+};
@@ -0,0 +1,454 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <vector>
+#include "Analysis.hpp"
+#include "MIR.hpp"
+
+// 寄存器分配和栈帧布局
+// 分配器是两个机器 pass (见 Pass.hpp), 把 MIR 中的虚拟寄存器换成物理寄存器:
+//   spill-all   : 每个虚拟寄存器都放在栈上, 用到时临时读进 t0/t1 (-O0)
+//   linear-scan : 按活跃区间做线性扫描分配, 放不下的溢出到栈上 (-O1 起)
+// t0, t1 留给溢出代码, t3 留给 FinalizeFrame 处理大偏移, 都不参与分配
+
+// 可分配的寄存器, 按优先顺序. 先用 caller-saved 的, 不用在 prologue 中保存,
+// 但跨过调用的区间, 以及和传参/返回值用到的 a0-a7 重叠的区间不能用 (见 FixedRanges).
+// a0, a1 最常用来传参, 放在最后. 之后是 callee-saved 的, 用到的要在 prologue 中保存
+const int rv_alloc_regs[] = {RV_T2, RV_T4, RV_T5, RV_T6, RV_A7, RV_A6, RV_A5, RV_A4,
+                             RV_A3, RV_A2, RV_A1, RV_A0, RV_S1, RV_S2, RV_S3, RV_S4,
+                             RV_S5, RV_S6, RV_S7, RV_S8, RV_S9, RV_S10, RV_S11};
+const int rv_alloc_reg_num = sizeof(rv_alloc_regs) / sizeof(rv_alloc_regs[0]);
+// -Os 时的顺序: 先用压缩指令能表示的 a5-a0, 其余 caller-saved 的在后面;
+// callee-saved 的 s0, s1 也在 x8-x15 里, 放在 s2-s11 前面 (s0 不当帧指针用, 这时也参与分配)
+const int rv_size_alloc_regs[] = {RV_A5, RV_A4, RV_A3, RV_A2, RV_A1, RV_A0, RV_T2, RV_T4,
+                                  RV_T5, RV_T6, RV_A7, RV_A6, RV_S0, RV_S1, RV_S2, RV_S3,
+                                  RV_S4, RV_S5, RV_S6, RV_S7, RV_S8, RV_S9, RV_S10, RV_S11};
+
+inline bool IsCalleeSaved(int reg)
+{
+  return reg == RV_S0 || reg == RV_S1 || (reg >= RV_S2 && reg <= RV_S11);
+}
+
+// 按分配结果改写函数: phys[v] >= 0 是分到的物理寄存器, 否则溢出到栈上
+void RewriteVRegs(MFunction &func, const std::vector<int> &phys)
+{
+  std::vector<int> slots(phys.size(), -1);
+  auto slot = [&](int v)
+  {
+    if (slots[v] < 0)
+      slots[v] = func.NewFrameObject(4);
+    return slots[v];
+  };
+  auto spilled = [&](int reg)
+  {
+    return IsVReg(reg) && phys[reg - rv_vreg_base] < 0;
+  };
+  for (auto &block : func.blocks)
+  {
+    std::vector<RVInst> insts;
+    insts.reserve(block.insts.size());
+    for (RVInst inst : block.insts)
+    {
+      // mv 的一边是物理寄存器, 另一边溢出了: 直接读写栈
+      if (inst.op == RV_ADDI && inst.imm == 0 && inst.reloc == RV_R_NONE)
+      {
+        if (!IsVReg(inst.rd) && spilled(inst.rs1))
+        {
+          insts.push_back(RVInst(RV_LW, inst.rd, RV_SP, 0, 0, RV_R_FRAME, slot(inst.rs1 - rv_vreg_base)));
+          continue;
+        }
+        if (spilled(inst.rd) && !IsVReg(inst.rs1))
+        {
+          insts.push_back(RVInst(RV_SW, 0, RV_SP, inst.rs1, 0, RV_R_FRAME, slot(inst.rd - rv_vreg_base)));
+          continue;
+        }
+      }
+      int uses[2];
+      int use_num = InstUses(inst, uses);
+      // 读的寄存器: 溢出的先读进 t0 (rs1) 或 t1 (rs2)
+      for (int k = 0; k < use_num; ++k)
+      {
+        int &reg = k == 0 ? inst.rs1 : inst.rs2;
+        if (!IsVReg(reg))
+          continue;
+        int v = reg - rv_vreg_base;
+        if (phys[v] >= 0)
+          reg = phys[v];
+        else if (k == 1 && uses[0] == uses[1])
+          reg = inst.rs1;
+        else
+        {
+          int scratch = k == 0 ? RV_T0 : RV_T1;
+          insts.push_back(RVInst(RV_LW, scratch, RV_SP, 0, 0, RV_R_FRAME, slot(v)));
+          reg = scratch;
+        }
+      }
+      // 写的寄存器: 溢出的先写进 t0 再存回栈上
+      int def = InstDef(inst);
+      if (def >= 0 && IsVReg(def))
+      {
+        int v = def - rv_vreg_base;
+        if (phys[v] >= 0)
+          inst.rd = phys[v];
+        else
+        {
+          inst.rd = RV_T0;
+          insts.push_back(inst);
+          insts.push_back(RVInst(RV_SW, 0, RV_SP, RV_T0, 0, RV_R_FRAME, slot(v)));
+          continue;
+        }
+      }
+      insts.push_back(inst);
+    }
+    block.insts.swap(insts);
+  }
+  func.vreg_num = rv_vreg_base;
+}
+
+// spill-all: 不做分配, 所有虚拟寄存器都放在栈上
+int RunSpillAll(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    changes += func.vreg_num - rv_vreg_base;
+    RewriteVRegs(func, std::vector<int>(func.vreg_num - rv_vreg_base, -1));
+  }
+  return changes;
+}
+
+// MIR 中直接用到的 caller-saved 物理寄存器被占用的区间 (位置的含义同 LinearScan), 只在基本块内:
+//   - 入口块中参数寄存器从函数开始到被读出
+//   - 传参和返回值从写入到 call / ret
+//   - call 破坏所有 caller-saved 寄存器, 返回值 a0 从 call 到被读出
+// 和这些区间重叠的虚拟寄存器不能分到对应的寄存器
+std::vector<std::vector<std::pair<int, int>>> FixedRanges(const MFunction &func)
+{
+  std::vector<std::vector<std::pair<int, int>>> ranges(32);
+  int open[32], last[32];
+  auto close = [&](int r)
+  {
+    if (open[r] >= 0)
+      ranges[r].push_back({open[r], last[r]});
+    open[r] = -1;
+  };
+  auto use = [&](int r, int pos)
+  {
+    if (open[r] >= 0)
+      last[r] = pos;
+  };
+  int pos = 0;
+  for (size_t b = 0; b < func.blocks.size(); ++b)
+  {
+    std::fill(open, open + 32, -1);
+    if (b == 0)
+    {
+      // 入口块里先读后写的 a0-a7 是传进来的参数
+      bool written[32] = {false};
+      for (auto &inst : func.blocks[0].insts)
+      {
+        int uses[2];
+        int k = InstUses(inst, uses);
+        for (int i = 0; i < k; ++i)
+          if (uses[i] >= RV_A0 && uses[i] <= RV_A7 && !written[uses[i]])
+            open[uses[i]] = last[uses[i]] = 0;
+        int def = InstDef(inst);
+        if (def >= 0 && !IsVReg(def))
+          written[def] = true;
+        if (inst.op == RV_CALL)
+          break;
+      }
+    }
+    for (auto &inst : func.blocks[b].insts)
+    {
+      int uses[2];
+      int k = InstUses(inst, uses);
+      for (int i = 0; i < k; ++i)
+        if (!IsVReg(uses[i]))
+          use(uses[i], pos);
+      if (inst.op == RV_CALL)
+      {
+        for (int r = RV_A0; r <= RV_A7; ++r)
+          use(r, pos);
+        for (int r : rv_alloc_regs)
+          if (!IsCalleeSaved(r))
+          {
+            close(r);
+            open[r] = pos;
+            last[r] = pos + 1;
+          }
+      }
+      else if (inst.op == RV_JALR && inst.rd == RV_ZERO && inst.rs1 == RV_RA)
+        use(RV_A0, pos);
+      int def = InstDef(inst);
+      if (def > 0 && !IsVReg(def))
+      {
+        close(def);
+        open[def] = last[def] = pos + 1;
+      }
+      pos += 2;
+    }
+    for (int r = 0; r < 32; ++r)
+      close(r);
+  }
+  return ranges;
+}
+
+// 线性扫描 (Poletto & Sarkar). 每个虚拟寄存器的活跃区间取覆盖所有活跃位置的一整段,
+// 第 i 条指令读操作数的位置是 2i, 写结果的位置是 2i + 1.
+// 不调用别的函数, 寄存器压力又不大时, 只会用到 caller-saved 寄存器, 不需要保存任何寄存器
+void LinearScan(MFunction &func, const Liveness &live)
+{
+  int n = func.vreg_num - rv_vreg_base;
+  std::vector<int> start(n, INT_MAX), end(n, -1);
+  // 和物理寄存器之间的 mv (读参数, 传参, 返回值): 优先分到同一个寄存器, mv 就可以删掉
+  std::vector<int> hint(n, -1);
+  // -Os 时结果优先和第一个操作数 (可交换的运算也可以是第二个) 用同一个寄存器,
+  // 操作数在这里死掉时就得到 rd == rs1 的两地址形式, 可以压缩 (见 RVAsm.hpp 的 RVCSize)
+  std::vector<int> tie(n, -1);
+  // 有 profile 时每个虚拟寄存器有多热: 读写它的块中最大的执行次数
+  std::vector<uint64_t> heat(n, 0);
+  auto extend = [&](int v, int pos)
+  {
+    start[v] = std::min(start[v], pos);
+    end[v] = std::max(end[v], pos);
+  };
+  int pos = 0;
+  for (size_t b = 0; b < func.blocks.size(); ++b)
+  {
+    int block_start = pos;
+    uint64_t count = func.blocks[b].count;
+    live.live_in[b].ForEach([&](int v)
+                            { extend(v, block_start); });
+    for (auto &inst : func.blocks[b].insts)
+    {
+      int uses[2];
+      int k = InstUses(inst, uses);
+      for (int i = 0; i < k; ++i)
+        if (IsVReg(uses[i]))
+        {
+          extend(uses[i] - rv_vreg_base, pos);
+          heat[uses[i] - rv_vreg_base] = std::max(heat[uses[i] - rv_vreg_base], count);
+        }
+      int def = InstDef(inst);
+      if (def >= 0 && IsVReg(def))
+      {
+        extend(def - rv_vreg_base, pos + 1);
+        heat[def - rv_vreg_base] = std::max(heat[def - rv_vreg_base], count);
+      }
+      if (inst.op == RV_ADDI && inst.imm == 0 && inst.reloc == RV_R_NONE && IsVReg(inst.rd) != IsVReg(inst.rs1))
+      {
+        if (IsVReg(inst.rd))
+          hint[inst.rd - rv_vreg_base] = inst.rs1;
+        else if (hint[inst.rs1 - rv_vreg_base] < 0)
+          hint[inst.rs1 - rv_vreg_base] = inst.rd;
+      }
+      else if (rv_opt_size && def >= 0 && IsVReg(def) && IsTwoAddress(inst.op))
+      {
+        if (IsVReg(inst.rs1) && inst.rs1 != def)
+          tie[def - rv_vreg_base] = inst.rs1 - rv_vreg_base;
+        else if (IsCommutative(inst.op) && IsVReg(inst.rs2) && inst.rs2 != def)
+          tie[def - rv_vreg_base] = inst.rs2 - rv_vreg_base;
+      }
+      pos += 2;
+    }
+    int block_end = pos - 1;
+    live.live_out[b].ForEach([&](int v)
+                             { extend(v, block_end); });
+  }
+
+  std::vector<int> order;
+  for (int v = 0; v < n; ++v)
+    if (end[v] >= 0)
+      order.push_back(v);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                   { return start[a] < start[b]; });
+
+  auto fixed = FixedRanges(func);
+  // 区间 v 能不能放进 r: 不和 r 被直接使用的区间重叠
+  auto fits = [&](int v, int r)
+  {
+    for (auto &range : fixed[r])
+      if (range.first <= end[v] && start[v] <= range.second)
+        return false;
+    return true;
+  };
+
+  // 溢出 a 是不是比溢出 b 好. 一般溢出结束得最晚的 (Poletto & Sarkar);
+  // 有 profile 时先溢出冷的, 一样热时才看结束的位置, 热路径上的值因此留在寄存器里
+  auto cheaper = [&](int a, int b)
+  {
+    if (func.profiled && heat[a] != heat[b])
+      return heat[a] < heat[b];
+    return end[a] > end[b];
+  };
+
+  const int *alloc_regs = rv_opt_size ? rv_size_alloc_regs : rv_alloc_regs;
+  int alloc_num = rv_opt_size ? sizeof(rv_size_alloc_regs) / sizeof(int) : rv_alloc_reg_num;
+  std::vector<int> phys(n, -1);
+  std::vector<int> active; // 占着寄存器的区间
+  bool busy[32] = {false};
+  bool used[32] = {false};
+  for (int v : order)
+  {
+    // 释放已经结束的区间
+    for (size_t i = 0; i < active.size();)
+      if (end[active[i]] < start[v])
+      {
+        busy[phys[active[i]]] = false;
+        active[i] = active.back();
+        active.pop_back();
+      }
+      else
+        i++;
+    int want = hint[v];
+    if (want < 0 && tie[v] >= 0)
+      want = phys[tie[v]];
+    int reg = -1;
+    for (int i = 0; i < alloc_num; ++i)
+    {
+      int r = alloc_regs[i];
+      if (!busy[r] && fits(v, r) && (reg < 0 || r == want))
+        reg = r;
+    }
+    if (reg < 0)
+    {
+      // 没有空闲寄存器: 在 v 和占着寄存器的区间里溢出最合适的那个 (它的寄存器要能放下 v)
+      int victim = -1;
+      for (size_t i = 0; i < active.size(); ++i)
+        if (fits(v, phys[active[i]]) && (victim < 0 || cheaper(active[i], active[victim])))
+          victim = i;
+      if (victim < 0 || !cheaper(active[victim], v))
+        continue;
+      reg = phys[active[victim]];
+      phys[active[victim]] = -1;
+      active[victim] = v;
+      phys[v] = reg;
+      continue;
+    }
+    busy[reg] = used[reg] = true;
+    phys[v] = reg;
+    active.push_back(v);
+  }
+
+  for (int i = 0; i < alloc_num; ++i)
+    if (used[alloc_regs[i]] && IsCalleeSaved(alloc_regs[i]))
+      func.saved_regs.push_back(alloc_regs[i]);
+  RewriteVRegs(func, phys);
+}
+
+int RunLinearScan(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    changes += func.vreg_num - rv_vreg_base;
+    LinearScan(func, am.GetLiveness(func));
+  }
+  return changes;
+}
+
+// 访问 sp + offset 处的内存, 偏移超出 12 位立即数时先用 t3 算出地址
+void AccessFrame(std::vector<RVInst> &insts, RVInst inst, int offset)
+{
+  inst.reloc = RV_R_NONE;
+  inst.sym = -1;
+  if (offset >= -2048 && offset <= 2047)
+  {
+    inst.rs1 = RV_SP;
+    inst.imm = offset;
+    insts.push_back(inst);
+    return;
+  }
+  insts.push_back(RVInst(RV_LI, RV_T3, 0, 0, offset));
+  insts.push_back(RVInst(RV_ADD, RV_T3, RV_T3, RV_SP));
+  inst.rs1 = RV_T3;
+  inst.imm = 0;
+  insts.push_back(inst);
+}
+
+// 调整栈指针, 同样要处理大立即数
+void AdjustStack(std::vector<RVInst> &insts, int offset)
+{
+  if (offset == 0)
+    return;
+  if (offset >= -2048 && offset <= 2047)
+  {
+    insts.push_back(RVInst(RV_ADDI, RV_SP, RV_SP, 0, offset));
+    return;
+  }
+  insts.push_back(RVInst(RV_LI, RV_T0, 0, 0, offset));
+  insts.push_back(RVInst(RV_ADD, RV_SP, RV_SP, RV_T0));
+}
+
+inline bool IsReturn(const RVInst &inst)
+{
+  return inst.op == RV_JALR && inst.rd == RV_ZERO && inst.rs1 == RV_RA;
+}
+
+// 寄存器分配之后调用: 确定栈帧布局 (按 16 字节对齐), 把栈帧对象换成 sp 偏移,
+// 在入口插入 prologue, 在每个 ret 前插入 epilogue.
+// 叶子函数 (不调用别的函数) 不保存 ra; 没有栈帧对象也没有要保存的寄存器时栈帧大小为 0,
+// 不调整 sp, prologue 和 epilogue 都是空的
+void FinalizeFrame(MFunction &func)
+{
+  // 从 sp 开始依次是传给被调用函数的栈上参数, 栈帧对象和保存的寄存器
+  if (func.has_call)
+    func.saved_regs.push_back(RV_RA);
+  // -Os 时访问多的对象放在靠近 sp 的地方, 偏移小才能用 c.lwsp/c.swsp (0-252) 和 c.lw/c.sw
+  std::vector<int> order(func.frame_objects.size());
+  for (size_t k = 0; k < order.size(); ++k)
+    order[k] = k;
+  if (rv_opt_size)
+  {
+    std::vector<int> accesses(order.size(), 0);
+    for (auto &block : func.blocks)
+      for (auto &inst : block.insts)
+        if (inst.reloc == RV_R_FRAME)
+          accesses[inst.sym]++;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                     { return accesses[a] > accesses[b]; });
+  }
+  std::vector<int> offsets(order.size());
+  int size = func.outgoing_size;
+  for (int k : order)
+  {
+    offsets[k] = size;
+    size += (func.frame_objects[k] + 3) / 4 * 4;
+  }
+  int save_base = size;
+  size += 4 * func.saved_regs.size();
+  size = (size + 15) / 16 * 16;
+  func.frame_size = size;
+  // 栈上传入的参数在调用者的栈帧里, 紧挨着本函数栈帧的上方
+  for (size_t k = 0; k < func.stack_params.size(); ++k)
+    offsets[func.stack_params[k]] = size + 4 * k;
+
+  for (size_t b = 0; b < func.blocks.size(); ++b)
+  {
+    auto &block = func.blocks[b];
+    std::vector<RVInst> insts;
+    insts.reserve(block.insts.size());
+    if (b == 0)
+    {
+      AdjustStack(insts, -size);
+      for (size_t i = 0; i < func.saved_regs.size(); ++i)
+        AccessFrame(insts, RVInst(RV_SW, 0, RV_SP, func.saved_regs[i]), save_base + 4 * i);
+    }
+    for (auto &inst : block.insts)
+    {
+      if (inst.reloc == RV_R_FRAME)
+        AccessFrame(insts, inst, offsets[inst.sym] + inst.imm);
+      else if (IsReturn(inst))
+      {
+        for (size_t i = 0; i < func.saved_regs.size(); ++i)
+          AccessFrame(insts, RVInst(RV_LW, func.saved_regs[i], RV_SP, 0), save_base + 4 * i);
+        AdjustStack(insts, size);
+        insts.push_back(inst);
+      }
+      else
+        insts.push_back(inst);
+    }
+    block.insts.swap(insts);
+  }
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "Analysis.hpp"
+#include "MIR.hpp"
+#include "RegAlloc.hpp"
+#include "RVSim.hpp"
+#include "Timer.hpp"
+
+// sched: 寄存器分配之前, 在每个基本块内做表调度 (list scheduling)
+// 指令选择按 IR 的顺序生成指令, load 和 mul/div 的结果往往紧接着就被使用,
+// 顺序流水线上会停顿. 这里按依赖图重排, 延迟取自 rv_cost_model (和 -sim 的周期模型一致):
+//   - 优先级是到块末尾的最长延迟路径, 相同时保持原来的顺序
+//   - 同时活跃的虚拟寄存器达到原来顺序下的最大值 (或可分配寄存器数) 时, 优先选不增加寄存器压力的指令
+//   - 块末尾的跳转指令不参与调度, call 和 ecall 是屏障
+// 只在块内移动指令, 块的 live_in / live_out 不变, 所以不会使活跃性分析失效.
+// 加上 -time 时输出每个函数按周期模型估计的周期数变化 "[sched] <函数> <调度前> -> <调度后>"
+
+const int sched_window = 128;
+
+struct SchedEdge
+{
+  int to;
+  int latency;
+};
+
+// 块内指令的依赖图
+struct SchedDAG
+{
+  std::vector<std::vector<SchedEdge>> succs;
+  std::vector<int> pred_num;
+
+  explicit SchedDAG(int n) : succs(n), pred_num(n) {}
+
+  void AddEdge(int from, int to, int latency)
+  {
+    if (from < 0 || from == to)
+      return;
+    succs[from].push_back({to, latency});
+    pred_num[to]++;
+  }
+};
+
+inline bool IsSchedBarrier(const RVInst &inst)
+{
+  return inst.op == RV_CALL || inst.op == RV_ECALL;
+}
+
+inline bool IsLoad(const RVInst &inst)
+{
+  return inst.op >= RV_LB && inst.op <= RV_LHU;
+}
+
+// 为 insts 建依赖图: 寄存器的写后读 (边权是延迟), 读后写, 写后写,
+// 以及访存的先后顺序. 不同栈帧对象之间, 栈帧对象和其他内存之间互不干扰
+SchedDAG BuildSchedDAG(const std::vector<RVInst> &insts, int reg_num)
+{
+  int n = insts.size();
+  SchedDAG dag(n);
+  std::vector<int> last_def(reg_num, -1);
+  std::vector<std::vector<int>> reads(reg_num); // 上次写之后读过这个寄存器的指令
+  // 内存: 下标 0 是栈帧以外的内存, 1 + k 是第 k 个栈帧对象
+  std::vector<int> last_store;
+  std::vector<std::vector<int>> loads;
+  int last_barrier = -1;
+  auto memory = [&](const RVInst &inst)
+  {
+    size_t k = inst.reloc == RV_R_FRAME ? inst.sym + 1 : 0;
+    if (k >= last_store.size())
+    {
+      last_store.resize(k + 1, -1);
+      loads.resize(k + 1);
+    }
+    return k;
+  };
+
+  for (int i = 0; i < n; ++i)
+  {
+    const RVInst &inst = insts[i];
+    if (IsSchedBarrier(inst))
+    {
+      // 紧挨着的两个 call 之间没有别的指令, 也要保持先后
+      dag.AddEdge(last_barrier, i, 1);
+      for (int j = last_barrier + 1; j < i; ++j)
+        dag.AddEdge(j, i, 1);
+      last_barrier = i;
+      continue;
+    }
+    dag.AddEdge(last_barrier, i, 1);
+
+    int uses[2];
+    int use_num = InstUses(inst, uses);
+    for (int k = 0; k < use_num; ++k)
+    {
+      int reg = uses[k];
+      if (reg == RV_ZERO)
+        continue;
+      if (last_def[reg] >= 0)
+        dag.AddEdge(last_def[reg], i, RVLatency(rv_cost_model, insts[last_def[reg]].op));
+      reads[reg].push_back(i);
+    }
+    int def = InstDef(inst);
+    if (def > 0)
+    {
+      for (int r : reads[def])
+        dag.AddEdge(r, i, 0);
+      reads[def].clear();
+      dag.AddEdge(last_def[def], i, 1);
+      last_def[def] = i;
+    }
+
+    char format = rv_op_info[inst.op].format;
+    if (format == 'S')
+    {
+      size_t k = memory(inst);
+      for (int l : loads[k])
+        dag.AddEdge(l, i, 0);
+      loads[k].clear();
+      dag.AddEdge(last_store[k], i, 1);
+      last_store[k] = i;
+    }
+    else if (IsLoad(inst))
+    {
+      size_t k = memory(inst);
+      dag.AddEdge(last_store[k], i, 1);
+      loads[k].push_back(i);
+    }
+  }
+  return dag;
+}
+
+// 按周期模型估计顺序执行一串指令的周期数: 每周期发射一条, 等待源操作数就绪
+uint64_t EstimateCycles(const std::vector<RVInst> &insts, const std::vector<int> &order, int reg_num)
+{
+  std::vector<uint64_t> ready(reg_num, 0);
+  uint64_t cycle = 0;
+  for (int i : order)
+  {
+    const RVInst &inst = insts[i];
+    uint64_t issue = cycle;
+    int uses[2];
+    int use_num = InstUses(inst, uses);
+    for (int k = 0; k < use_num; ++k)
+      issue = std::max(issue, ready[uses[k]]);
+    int def = InstDef(inst);
+    if (def > 0)
+      ready[def] = issue + RVLatency(rv_cost_model, inst.op);
+    cycle = issue + 1;
+  }
+  return cycle;
+}
+
+// 把块中用到的虚拟寄存器重新编号成 rv_vreg_base 开始的连续编号, 调度时的数组只和块的大小有关
+struct SchedBlock
+{
+  std::vector<RVInst> insts; // 块中除了末尾跳转以外的指令, 寄存器已重新编号
+  int reg_num = rv_vreg_base;
+  int live_in_num = 0;
+  Bitset live_out;
+};
+
+// 调度一个块, 返回新的顺序
+std::vector<int> ScheduleBlock(const SchedBlock &sb)
+{
+  const std::vector<RVInst> &insts = sb.insts;
+  int n = insts.size(), reg_num = sb.reg_num;
+  SchedDAG dag = BuildSchedDAG(insts, reg_num);
+
+  // 优先级: 从这条指令到块末尾的最长延迟路径
+  std::vector<int> height(n);
+  for (int i = n - 1; i >= 0; --i)
+  {
+    height[i] = RVLatency(rv_cost_model, insts[i].op);
+    for (auto &edge : dag.succs[i])
+      height[i] = std::max(height[i], edge.latency + height[edge.to]);
+  }
+
+  // 寄存器压力: 虚拟寄存器在块内还剩几次使用, 最后一次使用之后 (不是 live_out 的) 就不再占寄存器
+  std::vector<int> remaining(reg_num, 0);
+  for (int i = 0; i < n; ++i)
+  {
+    int uses[2];
+    int use_num = InstUses(insts[i], uses);
+    for (int k = 0; k < use_num; ++k)
+      if (IsVReg(uses[k]) && (k == 0 || uses[1] != uses[0]))
+        remaining[uses[k]]++;
+  }
+  int live = sb.live_in_num;
+  auto pressure_delta = [&](int i)
+  {
+    const RVInst &inst = insts[i];
+    int delta = 0;
+    int def = InstDef(inst);
+    if (def >= 0 && IsVReg(def))
+      delta++;
+    int uses[2];
+    int use_num = InstUses(inst, uses);
+    for (int k = 0; k < use_num; ++k)
+      if (IsVReg(uses[k]) && (k == 0 || uses[1] != uses[0]) && remaining[uses[k]] == 1 &&
+          !sb.live_out.Test(uses[k] - rv_vreg_base))
+        delta--;
+    return delta;
+  };
+  auto consume = [&](int i)
+  {
+    int uses[2];
+    int use_num = InstUses(insts[i], uses);
+    for (int k = 0; k < use_num; ++k)
+      if (IsVReg(uses[k]) && (k == 0 || uses[1] != uses[0]))
+        remaining[uses[k]]--;
+  };
+
+  // 压力上限取原来顺序下的最大压力 (不超过可分配寄存器数), 调度不会引入新的溢出,
+  // 也不会多用 callee-saved 寄存器
+  std::vector<int> initial = remaining;
+  int limit = live;
+  for (int i = 0, now = live; i < n; ++i)
+  {
+    now += pressure_delta(i);
+    consume(i);
+    limit = std::max(limit, now);
+  }
+  limit = std::min(limit, rv_alloc_reg_num);
+  remaining.swap(initial);
+
+  // 很长的块按 sched_window 条指令分段, 每段内部调度, 避免每次选择都扫描大量指令.
+  // ready 是本段中前驱都已调度的指令, earliest 是操作数就绪的周期
+  std::vector<int> ready;
+  std::vector<uint64_t> earliest(n, 0);
+  std::vector<int> order;
+  order.reserve(n);
+  uint64_t cycle = 0;
+  int region_end = 0;
+  while ((int)order.size() < n)
+  {
+    if ((int)order.size() == region_end)
+    {
+      int region_start = region_end;
+      region_end = std::min(n, region_start + sched_window);
+      for (int i = region_start; i < region_end; ++i)
+        if (dag.pred_num[i] == 0)
+          ready.push_back(i);
+    }
+    // 依次比较: 不用停顿的优先, 路径长的优先, 原来在前面的优先.
+    // 压力过高时只看是否增加压力, 然后回到原来的顺序 (表达式按深度优先生成, 压力最小)
+    bool high_pressure = live >= limit;
+    auto better = [&](int a, int b)
+    {
+      if (high_pressure)
+      {
+        bool grow_a = pressure_delta(a) > 0, grow_b = pressure_delta(b) > 0;
+        if (grow_a != grow_b)
+          return !grow_a;
+        return a < b;
+      }
+      bool stall_a = earliest[a] > cycle, stall_b = earliest[b] > cycle;
+      if (stall_a != stall_b)
+        return !stall_a;
+      if (stall_a && earliest[a] != earliest[b])
+        return earliest[a] < earliest[b];
+      if (height[a] != height[b])
+        return height[a] > height[b];
+      return a < b;
+    };
+    size_t best = 0;
+    for (size_t j = 1; j < ready.size(); ++j)
+      if (better(ready[j], ready[best]))
+        best = j;
+    int pick = ready[best];
+    ready[best] = ready.back();
+    ready.pop_back();
+    cycle = std::max(cycle, earliest[pick]);
+
+    live += pressure_delta(pick);
+    consume(pick);
+    order.push_back(pick);
+    for (auto &edge : dag.succs[pick])
+    {
+      earliest[edge.to] = std::max(earliest[edge.to], cycle + edge.latency);
+      if (--dag.pred_num[edge.to] == 0 && edge.to < region_end)
+        ready.push_back(edge.to);
+    }
+    cycle++;
+  }
+  return order;
+}
+
+SchedBlock MakeSchedBlock(const MBlock &block, const Bitset &live_in, const Bitset &live_out,
+                          std::vector<int> &local_id)
+{
+  SchedBlock sb;
+  std::vector<int> vregs;
+  auto rename = [&](int &reg)
+  {
+    if (!IsVReg(reg))
+      return;
+    int &id = local_id[reg - rv_vreg_base];
+    if (id < 0)
+    {
+      id = sb.reg_num++;
+      vregs.push_back(reg - rv_vreg_base);
+    }
+    reg = id;
+  };
+  size_t n = TerminatorStart(block);
+  sb.insts.assign(block.insts.begin(), block.insts.begin() + n);
+  for (auto &inst : sb.insts)
+  {
+    int uses[2];
+    int use_num = InstUses(inst, uses);
+    if (use_num > 0)
+      rename(inst.rs1);
+    if (use_num > 1)
+      rename(inst.rs2);
+    if (InstDef(inst) >= 0)
+      rename(inst.rd);
+  }
+  live_in.ForEach([&](int)
+                  { sb.live_in_num++; });
+  sb.live_out = Bitset(vregs.size());
+  for (size_t k = 0; k < vregs.size(); ++k)
+  {
+    if (live_out.Test(vregs[k]))
+      sb.live_out.Set(k);
+    local_id[vregs[k]] = -1;
+  }
+  return sb;
+}
+
+int RunSchedule(std::vector<MFunction> &funcs, AnalysisManager &am)
+{
+  int changes = 0;
+  for (auto &func : funcs)
+  {
+    const Liveness &live = am.GetLiveness(func);
+    std::vector<int> local_id(func.vreg_num - rv_vreg_base, -1);
+    uint64_t cycles_before = 0, cycles_after = 0;
+    for (size_t b = 0; b < func.blocks.size(); ++b)
+    {
+      auto &insts = func.blocks[b].insts;
+      SchedBlock sb = MakeSchedBlock(func.blocks[b], live.live_in[b], live.live_out[b], local_id);
+      int n = sb.insts.size();
+      std::vector<int> original(n);
+      for (int i = 0; i < n; ++i)
+        original[i] = i;
+      std::vector<int> order = ScheduleBlock(sb);
+      uint64_t before = EstimateCycles(sb.insts, original, sb.reg_num);
+      uint64_t after = EstimateCycles(sb.insts, order, sb.reg_num);
+      cycles_before += before;
+      // 估计不会更快时保持原样
+      if (after >= before)
+      {
+        cycles_after += before;
+        continue;
+      }
+      cycles_after += after;
+      std::vector<RVInst> scheduled;
+      scheduled.reserve(insts.size());
+      for (int i = 0; i < n; ++i)
+      {
+        scheduled.push_back(insts[order[i]]);
+        changes += order[i] != i;
+      }
+      scheduled.insert(scheduled.end(), insts.begin() + n, insts.end());
+      insts.swap(scheduled);
+    }
+    if (time_enabled)
+      std::cerr << "[sched] " << func.name << " " << cycles_before << " -> " << cycles_after << " (saved "
+                << cycles_before - cycles_after << ")" << std::endl;
+  }
+  return changes;
+}
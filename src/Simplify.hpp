@@ -0,0 +1,422 @@
+#pragma once
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Analysis.hpp"
+#include "IR.hpp"
+#include "IROpt.hpp"
+#include "Timer.hpp"
+
+// simplify: 代数化简和重结合
+// 对每条 binary 指令按顺序试 simplify_rules 中的规则, 一条规则的结果可以是:
+//   - 换成另一个值 (常量或已有的值), 这条指令删掉
+//   - 原地改写这条指令 (可能在它前面插入新指令)
+// 反复扫描整个函数直到没有规则生效. 规范形式是常量在右边, 减常量写成加负数,
+// 这样 add/mul/and/or/xor 链上的常量能一路结合到最外层再折叠掉.
+// 除以 0 等情况和 RISC-V 的结果一致 (见 IRFoldBinary), 不会把有定义的结果化简掉.
+// 加上 -time 时, 在 stderr 输出每个函数中生效的规则 "[simplify] <函数> <规则> <次数>"
+// 加新规则: 写一个 SimplifyRule 函数, 放进 simplify_rules
+
+// 规则能看到的上下文
+struct SimplifyContext
+{
+  std::unordered_map<koopa_raw_value_t, int> uses; // 每次扫描开始时数的使用次数, 只用来估计代价
+  std::vector<const void *> *inserted;             // 插到当前指令前面的新指令
+
+  // 在当前指令前面新建一条 binary 指令
+  koopa_raw_value_t NewBinary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+  {
+    koopa_raw_value_data_t *data = IRNewValue(&ir_int32_type);
+    data->kind.tag = KOOPA_RVT_BINARY;
+    data->kind.data.binary = {op, lhs, rhs};
+    inserted->push_back(data);
+    uses[data] = 1;
+    uses[lhs]++;
+    uses[rhs]++;
+    return data;
+  }
+};
+
+// 不适用时返回 nullptr, 原地改写时返回 inst 本身, 否则返回替换 inst 的值
+typedef koopa_raw_value_t (*SimplifyRule)(koopa_raw_value_data_t *inst, SimplifyContext &ctx);
+
+inline bool IRIsConst(koopa_raw_value_t value)
+{
+  return value->kind.tag == KOOPA_RVT_INTEGER;
+}
+
+inline int32_t IRConst(koopa_raw_value_t value)
+{
+  return value->kind.data.integer.value;
+}
+
+// value 是 op 运算时返回它的 binary, 否则返回 nullptr
+inline const koopa_raw_binary_t *IRBinary(koopa_raw_value_t value, koopa_raw_binary_op_t op)
+{
+  if (value->kind.tag != KOOPA_RVT_BINARY || value->kind.data.binary.op != op)
+    return nullptr;
+  return &value->kind.data.binary;
+}
+
+inline bool IRIsCompare(koopa_raw_binary_op_t op)
+{
+  return op <= KOOPA_RBO_LE;
+}
+
+// 满足结合律和交换律
+inline bool IRIsAssociative(koopa_raw_binary_op_t op)
+{
+  return op == KOOPA_RBO_ADD || op == KOOPA_RBO_MUL || op == KOOPA_RBO_AND || op == KOOPA_RBO_OR ||
+         op == KOOPA_RBO_XOR;
+}
+
+// a op b == b op' a
+inline koopa_raw_binary_op_t IRSwapCompare(koopa_raw_binary_op_t op)
+{
+  switch (op)
+  {
+  case KOOPA_RBO_GT: return KOOPA_RBO_LT;
+  case KOOPA_RBO_LT: return KOOPA_RBO_GT;
+  case KOOPA_RBO_GE: return KOOPA_RBO_LE;
+  case KOOPA_RBO_LE: return KOOPA_RBO_GE;
+  default: return op;
+  }
+}
+
+// !(a op b) == a op' b
+inline koopa_raw_binary_op_t IRInvertCompare(koopa_raw_binary_op_t op)
+{
+  switch (op)
+  {
+  case KOOPA_RBO_NOT_EQ: return KOOPA_RBO_EQ;
+  case KOOPA_RBO_EQ: return KOOPA_RBO_NOT_EQ;
+  case KOOPA_RBO_GT: return KOOPA_RBO_LE;
+  case KOOPA_RBO_LT: return KOOPA_RBO_GE;
+  case KOOPA_RBO_GE: return KOOPA_RBO_LT;
+  case KOOPA_RBO_LE: return KOOPA_RBO_GT;
+  default: assert(false); return op;
+  }
+}
+
+// 两边都是常量: 直接算出来
+koopa_raw_value_t SimplifyFold(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (!IRIsConst(b.lhs) || !IRIsConst(b.rhs))
+    return nullptr;
+  return IRInteger(IRFoldBinary(b.op, IRConst(b.lhs), IRConst(b.rhs)));
+}
+
+// c op x => x op c (可交换的运算), c < x => x > c (比较)
+koopa_raw_value_t SimplifyConstRight(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (!IRIsConst(b.lhs) || IRIsConst(b.rhs) || !(IRIsAssociative(b.op) || IRIsCompare(b.op)))
+    return nullptr;
+  std::swap(b.lhs, b.rhs);
+  b.op = IRSwapCompare(b.op);
+  return inst;
+}
+
+// x - c => x + (-c)
+koopa_raw_value_t SimplifySubConst(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (b.op != KOOPA_RBO_SUB || !IRIsConst(b.rhs) || IRIsConst(b.lhs))
+    return nullptr;
+  b.op = KOOPA_RBO_ADD;
+  b.rhs = IRInteger((int32_t)(0u - (uint32_t)IRConst(b.rhs)));
+  return inst;
+}
+
+// x + 0, x * 1, x / 1, x & -1, x | 0, x ^ 0, x << 0 ...  => x
+koopa_raw_value_t SimplifyIdentity(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (!IRIsConst(b.rhs))
+    return nullptr;
+  int32_t c = IRConst(b.rhs);
+  switch (b.op)
+  {
+  case KOOPA_RBO_ADD:
+  case KOOPA_RBO_SUB:
+  case KOOPA_RBO_OR:
+  case KOOPA_RBO_XOR:
+  case KOOPA_RBO_SHL:
+  case KOOPA_RBO_SHR:
+  case KOOPA_RBO_SAR:
+    return c == 0 ? b.lhs : nullptr;
+  case KOOPA_RBO_MUL:
+  case KOOPA_RBO_DIV:
+    return c == 1 ? b.lhs : nullptr;
+  case KOOPA_RBO_AND:
+    return c == -1 ? b.lhs : nullptr;
+  default:
+    return nullptr;
+  }
+}
+
+// x * 0, x & 0 => 0;  x | -1 => -1;  x % 1, x % -1, 0 % x => 0;  0 << x, 0 >> x => 0
+koopa_raw_value_t SimplifyAnnihilator(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (IRIsConst(b.rhs))
+  {
+    int32_t c = IRConst(b.rhs);
+    if ((b.op == KOOPA_RBO_MUL || b.op == KOOPA_RBO_AND) && c == 0)
+      return IRInteger(0);
+    if (b.op == KOOPA_RBO_OR && c == -1)
+      return IRInteger(-1);
+    if (b.op == KOOPA_RBO_MOD && (c == 1 || c == -1))
+      return IRInteger(0);
+  }
+  if (IRIsConst(b.lhs) && IRConst(b.lhs) == 0 &&
+      (b.op == KOOPA_RBO_MOD || b.op == KOOPA_RBO_SHL || b.op == KOOPA_RBO_SHR || b.op == KOOPA_RBO_SAR))
+    return IRInteger(0);
+  return nullptr;
+}
+
+// 两边是同一个值: x - x, x ^ x, x % x => 0;  x & x, x | x => x;  x == x => 1 ...
+// (x / x 在 x 为 0 时是 -1, 不化简)
+koopa_raw_value_t SimplifySelf(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (b.lhs != b.rhs || IRIsConst(b.lhs))
+    return nullptr;
+  switch (b.op)
+  {
+  case KOOPA_RBO_SUB:
+  case KOOPA_RBO_XOR:
+  case KOOPA_RBO_MOD:
+  case KOOPA_RBO_NOT_EQ:
+  case KOOPA_RBO_LT:
+  case KOOPA_RBO_GT:
+    return IRInteger(0);
+  case KOOPA_RBO_EQ:
+  case KOOPA_RBO_LE:
+  case KOOPA_RBO_GE:
+    return IRInteger(1);
+  case KOOPA_RBO_AND:
+  case KOOPA_RBO_OR:
+    return b.lhs;
+  default:
+    return nullptr;
+  }
+}
+
+// (x op c1) op c2 => x op (c1 op c2);  (c1 - x) + c2 => (c1 + c2) - x
+koopa_raw_value_t SimplifyReassoc(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (!IRIsConst(b.rhs))
+    return nullptr;
+  int32_t c2 = IRConst(b.rhs);
+  if (IRIsAssociative(b.op))
+    if (auto inner = IRBinary(b.lhs, b.op); inner && IRIsConst(inner->rhs))
+    {
+      b.rhs = IRInteger(IRFoldBinary(b.op, IRConst(inner->rhs), c2));
+      b.lhs = inner->lhs;
+      return inst;
+    }
+  if (b.op == KOOPA_RBO_ADD)
+    if (auto inner = IRBinary(b.lhs, KOOPA_RBO_SUB); inner && IRIsConst(inner->lhs))
+    {
+      b.op = KOOPA_RBO_SUB;
+      b.lhs = IRInteger(IRFoldBinary(KOOPA_RBO_ADD, IRConst(inner->lhs), c2));
+      b.rhs = inner->rhs;
+      return inst;
+    }
+  return nullptr;
+}
+
+// (x op c) op y => (x op y) op c, 把常量提到外层, 之后可以和外层的常量结合.
+// x op c 只有这一处用到时才做, 指令条数不变
+koopa_raw_value_t SimplifyHoistConst(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if (!IRIsAssociative(b.op) || IRIsConst(b.rhs))
+    return nullptr;
+  for (int side = 0; side < 2; ++side)
+  {
+    koopa_raw_value_t operand = side == 0 ? b.lhs : b.rhs, other = side == 0 ? b.rhs : b.lhs;
+    auto inner = IRBinary(operand, b.op);
+    if (!inner || !IRIsConst(inner->rhs) || IRIsConst(inner->lhs) || ctx.uses[operand] != 1)
+      continue;
+    b.lhs = ctx.NewBinary(b.op, inner->lhs, other);
+    b.rhs = inner->rhs;
+    ctx.uses[operand]--;
+    return inst;
+  }
+  return nullptr;
+}
+
+// 0 - (0 - x) => x;  x + (0 - y), (0 - y) + x => x - y;  x - (0 - y) => x + y
+koopa_raw_value_t SimplifyNeg(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  auto neg = [](koopa_raw_value_t value) -> koopa_raw_value_t
+  {
+    auto inner = IRBinary(value, KOOPA_RBO_SUB);
+    return inner && IRIsConst(inner->lhs) && IRConst(inner->lhs) == 0 ? inner->rhs : nullptr;
+  };
+  if (b.op == KOOPA_RBO_SUB && IRIsConst(b.lhs) && IRConst(b.lhs) == 0)
+    if (auto x = neg(b.rhs))
+      return x;
+  if (b.op == KOOPA_RBO_ADD)
+  {
+    if (auto y = neg(b.rhs))
+    {
+      b.op = KOOPA_RBO_SUB;
+      b.rhs = y;
+      return inst;
+    }
+    if (auto y = neg(b.lhs))
+    {
+      b.op = KOOPA_RBO_SUB;
+      b.lhs = b.rhs;
+      b.rhs = y;
+      return inst;
+    }
+  }
+  if (b.op == KOOPA_RBO_SUB && !IRIsConst(b.lhs))
+    if (auto y = neg(b.rhs))
+    {
+      b.op = KOOPA_RBO_ADD;
+      b.rhs = y;
+      return inst;
+    }
+  return nullptr;
+}
+
+// 比较的结果只有 0 和 1: (a < b) != 0, (a < b) == 1 => a < b;
+// (a < b) == 0, (a < b) != 1 => a >= b (于是 !!x 即 (x == 0) == 0 => x != 0)
+koopa_raw_value_t SimplifyCompare(koopa_raw_value_data_t *inst, SimplifyContext &ctx)
+{
+  auto &b = inst->kind.data.binary;
+  if ((b.op != KOOPA_RBO_EQ && b.op != KOOPA_RBO_NOT_EQ) || !IRIsConst(b.rhs) ||
+      b.lhs->kind.tag != KOOPA_RVT_BINARY || !IRIsCompare(b.lhs->kind.data.binary.op))
+    return nullptr;
+  int32_t c = IRConst(b.rhs);
+  if (c != 0 && c != 1)
+    return IRInteger(b.op == KOOPA_RBO_NOT_EQ);
+  const koopa_raw_binary_t &inner = b.lhs->kind.data.binary;
+  if ((b.op == KOOPA_RBO_NOT_EQ) == (c == 0))
+    return b.lhs;
+  b.op = IRInvertCompare(inner.op);
+  b.rhs = inner.rhs;
+  b.lhs = inner.lhs;
+  return inst;
+}
+
+struct SimplifyRuleEntry
+{
+  const char *name;
+  SimplifyRule apply;
+};
+
+const SimplifyRuleEntry simplify_rules[] = {
+    {"fold", SimplifyFold},
+    {"const-right", SimplifyConstRight},
+    {"sub-const", SimplifySubConst},
+    {"identity", SimplifyIdentity},
+    {"annihilator", SimplifyAnnihilator},
+    {"self", SimplifySelf},
+    {"reassoc", SimplifyReassoc},
+    {"hoist-const", SimplifyHoistConst},
+    {"neg", SimplifyNeg},
+    {"compare", SimplifyCompare},
+};
+const int simplify_rule_num = sizeof(simplify_rules) / sizeof(simplify_rules[0]);
+
+int RunSimplify(koopa_raw_program_t &program, AnalysisManager &am)
+{
+  int changes = 0;
+  std::vector<koopa_raw_value_t *> ops;
+  for (size_t f = 0; f < program.funcs.len; ++f)
+  {
+    koopa_raw_function_t func = IRFunction(program.funcs, f);
+    if (func->bbs.len == 0 || !IRSupported(func))
+      continue;
+    std::unordered_map<koopa_raw_value_t, koopa_raw_value_t> replace;
+    auto resolve = [&](koopa_raw_value_t value)
+    {
+      auto it = replace.find(value);
+      while (it != replace.end())
+      {
+        value = it->second;
+        it = replace.find(value);
+      }
+      return value;
+    };
+    int fired[simplify_rule_num] = {0};
+    SimplifyContext ctx;
+    std::vector<const void *> insts;
+    bool changed = true;
+    while (changed)
+    {
+      changed = false;
+      ctx.uses.clear();
+      for (size_t i = 0; i < func->bbs.len; ++i)
+      {
+        koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+        for (size_t j = 0; j < bb->insts.len; ++j)
+        {
+          ops.clear();
+          IROperands(IRValue(bb->insts, j), ops);
+          for (auto op : ops)
+            ctx.uses[resolve(*op)]++;
+        }
+      }
+      for (size_t i = 0; i < func->bbs.len; ++i)
+      {
+        koopa_raw_basic_block_t bb = IRBlock(func->bbs, i);
+        insts.clear();
+        ctx.inserted = &insts;
+        bool grown = false;
+        for (size_t j = 0; j < bb->insts.len; ++j)
+        {
+          koopa_raw_value_t inst = IRValue(bb->insts, j);
+          size_t before = insts.size();
+          if (inst->kind.tag == KOOPA_RVT_BINARY && !replace.count(inst))
+          {
+            auto &b = Mut(inst)->kind.data.binary;
+            b.lhs = resolve(b.lhs);
+            b.rhs = resolve(b.rhs);
+            for (int r = 0; r < simplify_rule_num; ++r)
+            {
+              koopa_raw_value_t result = simplify_rules[r].apply(Mut(inst), ctx);
+              if (!result)
+                continue;
+              fired[r]++;
+              changes++;
+              changed = true;
+              if (result != inst)
+              {
+                replace[inst] = result;
+                ctx.uses[result] += ctx.uses[inst];
+                break;
+              }
+            }
+          }
+          grown |= insts.size() > before;
+          insts.push_back(inst);
+        }
+        if (grown)
+          Mut(bb)->insts = IRSlice(insts, KOOPA_RSIK_VALUE);
+      }
+    }
+    if (!replace.empty())
+    {
+      IRReplaceUses(func, replace);
+      for (size_t i = 0; i < func->bbs.len; ++i)
+        IRRemoveInsts(IRBlock(func->bbs, i), [&](koopa_raw_value_t inst)
+                      { return replace.count(inst) > 0; });
+    }
+    if (time_enabled)
+      for (int r = 0; r < simplify_rule_num; ++r)
+        if (fired[r] > 0)
+          std::cerr << "[simplify] " << func->name + 1 << " " << simplify_rules[r].name << " " << fired[r] << std::endl;
+  }
+  return changes;
+}
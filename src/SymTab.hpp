@@ -0,0 +1,208 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// 符号表
+// parser 把每个标识符驻留 (intern) 成一个整数 ID, AST 中保存这个 ID,
+// 生成 IR 时按 ID 查找, 查找过程不做字符串比较也不分配内存.
+// 两张表都是开放寻址 (线性探测) 的哈希表, 装载因子超过 1/2 时扩容
+
+// 标识符 -> ID. 所有名字连续存放在一个字符数组里
+class SymbolInterner
+{
+public:
+  int Intern(const std::string &name)
+  {
+    if (2 * (lengths.size() + 1) > table.size())
+      Grow();
+    uint32_t hash = Hash(name.data(), name.size());
+    size_t mask = table.size() - 1;
+    for (size_t pos = hash & mask;; pos = (pos + 1) & mask)
+    {
+      int id = table[pos];
+      if (id < 0)
+      {
+        id = lengths.size();
+        offsets.push_back(chars.size());
+        lengths.push_back(name.size());
+        hashes.push_back(hash);
+        chars.insert(chars.end(), name.begin(), name.end());
+        table[pos] = id;
+        return id;
+      }
+      if (hashes[id] == hash && lengths[id] == name.size() &&
+          memcmp(&chars[offsets[id]], name.data(), name.size()) == 0)
+        return id;
+    }
+  }
+
+  std::string Name(int id) const
+  {
+    return std::string(&chars[offsets[id]], lengths[id]);
+  }
+
+private:
+  std::vector<char> chars;
+  std::vector<uint32_t> offsets, lengths, hashes;
+  std::vector<int> table; // 槽中是 ID, -1 表示空
+
+  static uint32_t Hash(const char *s, size_t n)
+  {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+      hash = (hash ^ (uint8_t)s[i]) * 16777619u;
+    return hash;
+  }
+
+  void Grow()
+  {
+    table.assign(table.empty() ? 64 : table.size() * 2, -1);
+    size_t mask = table.size() - 1;
+    for (size_t id = 0; id < lengths.size(); ++id)
+    {
+      size_t pos = hashes[id] & mask;
+      while (table[pos] >= 0)
+        pos = (pos + 1) & mask;
+      table[pos] = id;
+    }
+  }
+};
+
+// 全局唯一的驻留表 (inline 的原因见 AST.hpp 开头)
+inline SymbolInterner symbol_interner;
+
+// 并行解析 (见 Parse.hpp) 时 worker 线程不能直接驻留: 驻留的先后决定 ID, 要和串行解析得到的一样.
+// 设置了 deferred_symbols 的线程只记下要填的位置和名字 (都在 AST 结点里, 地址不会变),
+// 解析完由主线程按源文件中的顺序统一驻留
+struct DeferredSymbol
+{
+  int *sym;
+  const std::string *name;
+};
+inline thread_local std::vector<DeferredSymbol> *deferred_symbols = nullptr;
+
+// parser 中给 AST 结点的 sym 赋值
+inline void InternSymbol(int &sym, const std::string &name)
+{
+  if (deferred_symbols)
+    deferred_symbols->push_back({&sym, &name});
+  else
+    sym = symbol_interner.Intern(name);
+}
+
+enum class SymbolKind
+{
+  constT,
+  varT,
+  funcT
+};
+
+struct SymbolEntry
+{
+  int sym;         // 标识符 ID
+  SymbolKind kind;
+  int32_t value;   // 常量折叠后的值; 函数的参数个数
+  int slot;        // 变量在 IR 中的名字是 %<标识符>_<slot>; 函数有返回值时为 1, void 时为 0
+  int shadowed;    // 被遮蔽的外层定义 (在 entries 中的下标), 没有时为 -1
+};
+
+// 作用域符号表
+// 所有定义按顺序放在 entries 里, 进入作用域时记下 entries 的长度,
+// 退出时把这之后的定义弹出, 并让哈希表指回它们遮蔽的外层定义.
+// 哈希表从标识符 ID 映射到最内层定义的下标
+class SymbolTable
+{
+public:
+  void EnterScope()
+  {
+    scopes.push_back(entries.size());
+  }
+
+  void ExitScope()
+  {
+    size_t marker = scopes.back();
+    scopes.pop_back();
+    while (entries.size() > marker)
+    {
+      const SymbolEntry &entry = entries.back();
+      heads[Find(entry.sym)] = entry.shadowed;
+      entries.pop_back();
+    }
+  }
+
+  // 在当前作用域中定义, 同一作用域中重复定义时返回 nullptr.
+  // 返回的指针在下一次 Define 之前有效
+  const SymbolEntry *Define(int sym, SymbolKind kind, int32_t value = 0, int slot = -1)
+  {
+    if (2 * (used + 1) > keys.size())
+      Grow();
+    size_t pos = Find(sym);
+    if (keys[pos] < 0)
+    {
+      keys[pos] = sym;
+      heads[pos] = -1;
+      used++;
+    }
+    int outer = heads[pos];
+    if (outer >= 0 && (size_t)outer >= (scopes.empty() ? 0 : scopes.back()))
+      return nullptr;
+    if ((size_t)sym >= slots.size())
+      slots.resize(sym + 1, 0);
+    if (kind == SymbolKind::varT)
+      slot = slots[sym]++;
+    heads[pos] = entries.size();
+    entries.push_back({sym, kind, value, slot, outer});
+    return &entries.back();
+  }
+
+  // 最内层的定义, 没有时返回 nullptr
+  const SymbolEntry *Lookup(int sym) const
+  {
+    if (keys.empty())
+      return nullptr;
+    size_t pos = Find(sym);
+    if (keys[pos] < 0 || heads[pos] < 0)
+      return nullptr;
+    return &entries[heads[pos]];
+  }
+
+private:
+  std::vector<SymbolEntry> entries;
+  std::vector<size_t> scopes; // 每个作用域开始时 entries 的长度
+  std::vector<int> keys;      // 标识符 ID, -1 表示空槽
+  std::vector<int> heads;     // 最内层定义的下标, -1 表示当前没有定义
+  size_t used = 0;
+  int shift = 0;
+  std::vector<int> slots;     // 每个标识符已经用掉的 IR 名字个数, 保证遮蔽的变量名字不同
+
+  size_t Find(int sym) const
+  {
+    // 乘法哈希, 取乘积的高位
+    size_t mask = keys.size() - 1;
+    size_t pos = ((uint32_t)sym * 2654435769u) >> shift;
+    while (keys[pos] >= 0 && keys[pos] != sym)
+      pos = (pos + 1) & mask;
+    return pos;
+  }
+
+  void Grow()
+  {
+    std::vector<int> old_keys = std::move(keys), old_heads = std::move(heads);
+    keys.assign(old_keys.empty() ? 64 : old_keys.size() * 2, -1);
+    heads.assign(keys.size(), -1);
+    shift = 32 - __builtin_ctz(keys.size());
+    for (size_t i = 0; i < old_keys.size(); ++i)
+      if (old_keys[i] >= 0)
+      {
+        size_t pos = Find(old_keys[i]);
+        keys[pos] = old_keys[i];
+        heads[pos] = old_heads[i];
+      }
+  }
+};
+
+// 全局唯一的符号表
+inline SymbolTable symbol_table;
@@ -0,0 +1,73 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// 编译各阶段计时. 命令行加上 -time 后, 结束时输出到 stderr, 格式为
+//   [time] <阶段名> <毫秒>
+// bench/bench.cpp 依赖这个格式.
+// 计时可以嵌套 (边解析边编译时, 后端各阶段在 parse 里面), 每个阶段只记自己的时间,
+// 不含嵌套在里面的阶段. 同名阶段的时间累加, 按第一次开始的顺序输出
+struct PhaseTime
+{
+  std::string name;
+  double ms;
+};
+static bool time_enabled = false;
+static std::vector<PhaseTime> phase_times;
+
+static void AddPhaseTime(const std::string &name, double ms)
+{
+  for (auto &phase : phase_times)
+    if (phase.name == name)
+    {
+      phase.ms += ms;
+      return;
+    }
+  phase_times.push_back({name, ms});
+}
+
+// 在作用域内计时, 析构时记录
+class PhaseTimer
+{
+public:
+  explicit PhaseTimer(const std::string &name)
+      : name(name), parent(current), start(std::chrono::steady_clock::now())
+  {
+    current = this;
+    if (time_enabled)
+      AddPhaseTime(name, 0); // 按开始的顺序输出
+  }
+  ~PhaseTimer()
+  {
+    current = parent;
+    if (!time_enabled)
+      return;
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    if (parent)
+      parent->nested += ms;
+    AddPhaseTime(name, ms - nested);
+  }
+
+private:
+  static inline PhaseTimer *current = nullptr; // 最内层正在计时的阶段
+  std::string name;
+  PhaseTimer *parent;
+  double nested = 0; // 嵌套在里面的阶段用掉的时间
+  std::chrono::steady_clock::time_point start;
+};
+
+static void ReportPhaseTimes()
+{
+  if (!time_enabled)
+    return;
+  double total = 0;
+  for (auto &phase : phase_times)
+  {
+    std::cerr << "[time] " << phase.name << " " << phase.ms << std::endl;
+    total += phase.ms;
+  }
+  std::cerr << "[time] total " << total << std::endl;
+}
@@ -1,23 +1,182 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "AST.hpp"
+#include "ASTCache.hpp"
+#include "ELF.hpp"
+#include "Interp.hpp"
 #include "koopa.h"
+#include "MappedFile.hpp"
+#include "Parse.hpp"
+#include "Pass.hpp"
+#include "Profile.hpp"
 #include "RISCV.hpp"
+#include "RVSim.hpp"
+#include "Timer.hpp"
 
 using namespace std;
 
-// 声明 lexer 的输入, 以及 parser 函数
-// 为什么不引用 sysy.tab.hpp 呢? 因为首先里面没有 yyin 的定义
-// 其次, 因为这个文件不是我们自己写的, 而是被 Bison 生成出来的
-// 你的代码编辑器/IDE 很可能找不到这个文件, 然后会给你报错 (虽然编译不会出错)
-// 看起来会很烦人, 于是干脆采用这种看起来 dirty 但实际很有效的手段
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
+// 解析 koopa IR 文本, 得到按 -O / -passes= 优化过的 raw program, builder 由调用者释放
+koopa_raw_program_t ParseRawProgram(const char *ir, koopa_raw_program_builder_t &builder)
+{
+  koopa_raw_program_t raw;
+  {
+    PhaseTimer timer("koopa");
+    // 解析字符串 str, 得到 Koopa IR 程序
+    koopa_program_t program;
+    koopa_error_code_t ret = koopa_parse_from_string(ir, &program);
+    if (ret != KOOPA_EC_SUCCESS)
+    {
+      cerr << "Invalid koopa IR (error code " << ret << ")" << endl;
+      exit(1);
+    }
+    // 创建一个 raw program builder, 用来构建 raw program
+    builder = koopa_new_raw_program_builder();
+    // 将 Koopa IR 程序转换为 raw program
+    raw = koopa_build_raw_program(builder, program);
+    // 释放 Koopa IR 程序占用的内存
+    koopa_delete_program(program);
+  }
+  // 按 -O / -passes= 选择的流水线优化 raw program
+  {
+    PhaseTimer timer("opt");
+    pass_manager.RunIR(raw);
+  }
+  return raw;
+}
+
+// 生成 koopa IR 文本
+// -riscv, -obj, -sim 模式对每个函数调用一次, -interp 对整个程序调用一次
+string GenerateIR(const unique_ptr<BaseAST> &ast)
+{
+  PhaseTimer timer("ir");
+  //  创建一个stringstream对象，用于存储输出
+  stringstream ss;
+  // 保存cout的当前缓冲区指针到coutBuf，以便恢复
+  streambuf *coutBuf = cout.rdbuf();
+  // 将cout的缓冲区指向ss的缓冲区，这样cout输出的内容就会存到ss中
+  cout.rdbuf(ss.rdbuf());
+  // 输出IR
+  ast->DumpIR();
+  // 恢复cout的缓冲区指针
+  cout.rdbuf(coutBuf);
+  // 从ss中读取字符串
+  return ss.str();
+}
+
+// 整个程序的 raw program (-interp), builder 由调用者释放
+koopa_raw_program_t BuildRawProgram(const unique_ptr<BaseAST> &ast, koopa_raw_program_builder_t &builder)
+{
+  string IRstr = GenerateIR(ast);
+  // 获取c风格的字符串表示
+  return ParseRawProgram(IRstr.data(), builder);
+}
+
+// 边解析边编译时已经编译过的函数 (按标识符 ID). 之后的函数单独编译, 调用它们时要在 IR 前面补上声明.
+// 流水线里有 inline 时, 足够小的函数还保留 IR 文本, 把定义一起带上, inline pass 才看得到函数体
+struct CompiledFunction
+{
+  string decl;         // decl @f(i32, i32): i32
+  string ir;           // 可能被内联时是完整的定义, 否则为空
+  vector<int> callees;
+};
+unordered_map<int, CompiledFunction> compiled_functions;
+
+// 保留 IR 文本的函数的最大行数. 前端生成的 IR 还没优化过, 比 inline pass 看到的大得多
+const size_t inline_source_lines = 4 * inline_threshold;
+
+// 把 sym 的声明或定义 (连同它调用的函数, 被调用的在前) 加到 prelude 里
+void AddPrelude(int sym, int self, unordered_set<int> &added, string &prelude)
+{
+  if (sym == self || !added.insert(sym).second)
+    return;
+  const CompiledFunction &func = compiled_functions.at(sym);
+  if (func.ir.empty())
+  {
+    prelude += func.decl + "\n";
+    return;
+  }
+  for (int callee : func.callees)
+    AddPrelude(callee, self, added, prelude);
+  prelude += func.ir;
+}
+
+// -koopa-in: 输入文件本身就是 koopa IR, 映射到内存后直接解析, 跳过前端
+koopa_raw_program_t LoadRawProgram(const char *path, koopa_raw_program_builder_t &builder)
+{
+  MappedFile file;
+  {
+    PhaseTimer timer("read");
+    if (!file.Open(path))
+    {
+      cerr << "Cannot read " << path << endl;
+      exit(1);
+    }
+  }
+  return ParseRawProgram(file.Data(), builder);
+}
+
+// 边解析边编译: parser 每解析完一个顶层函数就调用这里, 返回后这个函数的 AST 和 IR 都已释放,
+// 峰值内存只和最大的函数有关, 和整个文件的大小无关.
+// -koopa, -riscv 直接输出这个函数的部分; -obj, -sim 把机器码追加到 rv_program, 解析完后一起写出或运行
+void CompileTopLevel(const string &mode, unique_ptr<BaseAST> func)
+{
+  if (mode == "-koopa")
+  {
+    PhaseTimer timer("ir");
+    func->DumpIR();
+    cout << endl;
+    return;
+  }
+  auto func_def = static_cast<FuncDefAST *>(func.get());
+  ir_callees.clear();
+  string ir = GenerateIR(func);
+  string prelude;
+  unordered_set<int> added;
+  for (int callee : ir_callees)
+    AddPrelude(callee, func_def->sym, added, prelude);
+
+  CompiledFunction &compiled = compiled_functions[func_def->sym];
+  compiled.decl = "decl @" + func_def->ident + "(";
+  for (size_t i = 0; i < func_def->params.size(); ++i)
+    compiled.decl += i > 0 ? ", i32" : "i32";
+  compiled.decl += static_cast<FuncTypeAST *>(func_def->func_type.get())->funcT_name == "int" ? "): i32" : ")";
+  compiled.callees = ir_callees;
+  if (pass_manager.Enabled("inline") && (size_t)count(ir.begin(), ir.end(), '\n') <= inline_source_lines)
+    compiled.ir = ir;
+  string name = "@" + func_def->ident;
+  func.reset();
+
+  koopa_raw_program_builder_t builder;
+  koopa_raw_program_t raw = ParseRawProgram((prelude + ir).c_str(), builder);
+  // 一起带上的定义已经在之前编译过了, 这里变成声明, 不再生成代码
+  for (size_t i = 0; i < raw.funcs.len; ++i)
+    if (name != IRFunction(raw.funcs, i)->name)
+      Mut(IRFunction(raw.funcs, i))->bbs.len = 0;
+  if (mode == "-riscv")
+  {
+    // GenerateRISCV 内部分 isel, mopt, lower 三个阶段计时
+    RVProgram program = GenerateRISCV(raw);
+    koopa_delete_raw_program_builder(builder);
+    PhaseTimer timer("emit");
+    PrintProgram(program, cout);
+    cout << endl;
+  }
+  else
+  {
+    AppendRISCV(raw);
+    koopa_delete_raw_program_builder(builder);
+  }
+}
 
 int main(int argc, const char *argv[])
 {
@@ -28,69 +187,280 @@ int main(int argc, const char *argv[])
   // cin.tie(nullptr);
 
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [选项...]
+  // 模式: -test, -koopa, -riscv, -obj (直接输出 ELF 目标文件),
+  //       -interp (解释执行 koopa IR), -sim (模拟执行生成的汇编)
+  // 选项: -time 输出各阶段耗时 (见 Timer.hpp)
+  //       -sim-cost=mul=3,div=20,... 设置 -sim 的周期模型 (见 RVSim.hpp)
+  //       -O0, -O1, -O2, -Os, -passes=a,b,..., -f[no-]sched 选择优化 pass (见 Pass.hpp)
+  //       -koopa-in 输入文件是 koopa IR, 跳过前端只跑后端 (-riscv, -obj, -sim, -interp)
+  //       -ast-cache=<文件> 源文件没变时从这个文件读回 AST, 跳过 flex/bison; 否则解析后写入 (见 ASTCache.hpp)
+  //       -parse-jobs=N 把源文件在顶层定义之间切开, 用 N 个线程并行解析 (见 Parse.hpp)
+  //       -fprofile-generate=<文件> -interp 时把基本块和边的执行次数写进这个文件 (见 Interp.hpp)
+  //       -fprofile-use=<文件> 按这些次数安排基本块的顺序和溢出的变量 (见 Profile.hpp)
+  assert(argc >= 5);
   string mode = (string)argv[1];
   auto input = argv[2];
   auto output = argv[4];
+  bool koopa_in = false;
+  string ast_cache_path;
+  int parse_jobs = 1;
+  string profile_generate;
+  for (int i = 5; i < argc; ++i)
+  {
+    string option = argv[i];
+    if (option == "-time")
+      time_enabled = true;
+    else if (option == "-koopa-in")
+      koopa_in = true;
+    else if (option.rfind("-ast-cache=", 0) == 0)
+      ast_cache_path = option.substr(11);
+    else if (option.rfind("-parse-jobs=", 0) == 0 && atoi(option.c_str() + 12) > 0)
+      parse_jobs = atoi(option.c_str() + 12);
+    else if (option.rfind("-fprofile-generate=", 0) == 0)
+      profile_generate = option.substr(19);
+    else if (option.rfind("-fprofile-use=", 0) == 0)
+    {
+      if (!profile_use.Load(option.substr(14)))
+      {
+        cerr << "Cannot read profile " << option.substr(14) << endl;
+        return 1;
+      }
+    }
+    else if (option.rfind("-sim-cost=", 0) == 0 && ParseCostModel(option.substr(10), rv_cost_model))
+      continue;
+    else if (pass_manager.ParseOption(option))
+      continue;
+    else
+    {
+      cerr << "Unknown option: " << option << endl;
+      return 1;
+    }
+  }
 
-  // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-  yyin = fopen(input, "r");
-  assert(yyin);
+  if (koopa_in && (mode == "-test" || mode == "-koopa"))
+  {
+    cerr << "-koopa-in cannot be used with " << mode << endl;
+    return 1;
+  }
+  if (!profile_generate.empty() && mode != "-interp")
+  {
+    cerr << "-fprofile-generate can only be used with -interp" << endl;
+    return 1;
+  }
+  if (koopa_in && !ast_cache_path.empty())
+  {
+    cerr << "-koopa-in cannot be used with -ast-cache" << endl;
+    return 1;
+  }
+  if (mode == "-koopa" || mode == "-riscv")
+    freopen(output, "w", stdout);
 
-  // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
   unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
+  // -koopa-in 时整个程序的 raw program, -interp 时由 AST 生成
+  koopa_raw_program_builder_t builder = nullptr;
+  koopa_raw_program_t raw;
+  if (koopa_in)
+  {
+    // 只跑后端: 计时中没有 parse 和 ir, 其余阶段和从 SysY 编译时相同
+    raw = LoadRawProgram(input, builder);
+    if (mode != "-interp")
+    {
+      AppendRISCV(raw);
+      koopa_delete_raw_program_builder(builder);
+    }
+  }
+  else
+  {
+    // 除了 -test 和 -interp, 其余模式都边解析边编译, 每个函数解析完就处理掉 (见 CompileTopLevel)
+    bool streaming = mode == "-koopa" || mode == "-riscv" || mode == "-obj" || mode == "-sim";
+    uint64_t source_size = 0, source_hash = 0;
+    ASTCache cache;
+    bool cached = false;
+    if (!ast_cache_path.empty())
+    {
+      PhaseTimer timer("ast-cache");
+      MappedFile source;
+      if (!source.Open(input))
+      {
+        cerr << "Cannot read " << input << endl;
+        return 1;
+      }
+      source_size = source.Size();
+      source_hash = ASTCacheHash(source.Data(), source.Size());
+      cached = cache.Open(ast_cache_path.c_str(), source_size, source_hash);
+    }
+    if (cached)
+    {
+      // 跳过 flex/bison, 按顶层函数逐个重建 AST, 和 parser 交出来的一样处理
+      PhaseTimer timer("ast-cache");
+      auto comp_unit = make_unique<CompUnitAST>();
+      for (size_t i = 0; i < cache.RootCount(); ++i)
+        if (streaming)
+          CompileTopLevel(mode, cache.Root(i));
+        else
+          comp_unit->func_defs.push_back(cache.Root(i));
+      ast = move(comp_unit);
+    }
+    else
+    {
+      ASTCacheWriter writer;
+      function<void(unique_ptr<BaseAST>)> handler;
+      if (streaming)
+        handler = [&](unique_ptr<BaseAST> func)
+        {
+          if (!ast_cache_path.empty())
+          {
+            PhaseTimer timer("ast-cache");
+            writer.AddRoot(func.get());
+          }
+          CompileTopLevel(mode, move(func));
+        };
+
+      // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
+      // 边解析边编译时, 后端各阶段的耗时不算在 parse 里 (见 Timer.hpp)
+      {
+        PhaseTimer timer("parse");
+        bool ok;
+        if (parse_jobs > 1)
+        {
+          // 并行解析时 parser 不调用 top_level_handler, 由主线程按顺序交出每个函数
+          MappedFile source;
+          if (!source.Open(input))
+          {
+            cerr << "Cannot read " << input << endl;
+            return 1;
+          }
+          auto comp_unit = make_unique<CompUnitAST>();
+          auto collect = [&](unique_ptr<BaseAST> func)
+          {
+            if (handler)
+              handler(move(func));
+            else
+              comp_unit->func_defs.push_back(move(func));
+          };
+          ok = ParseParallel(source.Data(), source.Size(), parse_jobs, collect);
+          ast = move(comp_unit);
+        }
+        else
+        {
+          top_level_handler = handler;
+          ok = ParseFile(input, ast);
+        }
+        assert(ok);
+      }
+      if (!ast_cache_path.empty())
+      {
+        PhaseTimer timer("ast-cache");
+        if (!streaming)
+          for (auto &func_def : static_cast<CompUnitAST *>(ast.get())->func_defs)
+            writer.AddRoot(func_def.get());
+        // 写不了缓存不影响编译
+        if (!writer.Save(ast_cache_path, source_size, source_hash))
+          cerr << "Cannot write AST cache " << ast_cache_path << endl;
+      }
+    }
+  }
   if (mode == "-test")
   {
     // freopen(output, "w", stdout);
     // 输出 AST
-    ast->Dump();
-    cout << endl;
+    {
+      PhaseTimer timer("dump");
+      ast->Dump();
+      cout << endl;
+    }
+    ReportPhaseTimes();
     return 0;
   }
-  else if (string(mode) == "-koopa")
+  else if (string(mode) == "-koopa" || string(mode) == "-riscv")
   {
-    freopen(output, "w", stdout);
-    // 输出 koopa IR
-    ast->DumpIR();
-    cout << endl;
+    // 从 SysY 编译时, 解析过程中已经逐个函数输出了
+    if (koopa_in)
+    {
+      RVProgram program;
+      {
+        PhaseTimer timer("lower");
+        program = FinishRISCV();
+      }
+      PhaseTimer timer("emit");
+      PrintProgram(program, cout);
+      cout << endl;
+    }
+    pass_manager.Report();
+    ReportPhaseTimes();
     return 0;
   }
-  else if (string(mode) == "-riscv")
-  {
-    // freopen("RISCV.txt", "w", stdout);
-    //  创建一个stringstream对象，用于存储输出
-    stringstream ss;
-    // 保存cout的当前缓冲区指针到coutBuf，以便恢复
-    streambuf *coutBuf = cout.rdbuf();
-    // 将cout的缓冲区指向ss的缓冲区，这样cout输出的内容就会存到ss中
-    cout.rdbuf(ss.rdbuf());
-    // 输出IR
-    ast->DumpIR();
-    // 从ss中读取字符串，存到IRstr中
-    string IRstr = ss.str();
-    // 获取c风格的字符串表示，存储在ir中
-    const char *ir = IRstr.data();
-    // 恢复cout的缓冲区指针
-    cout.rdbuf(coutBuf);
-    freopen(output, "w", stdout);
-    // 解析字符串 str, 得到 Koopa IR 程序
-    koopa_program_t program;
-    koopa_error_code_t ret = koopa_parse_from_string(ir, &program);
-    assert(ret == KOOPA_EC_SUCCESS); // 确保解析时没有出错
-    // 创建一个 raw program builder, 用来构建 raw program
-    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-    // 将 Koopa IR 程序转换为 raw program
-    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-    // 释放 Koopa IR 程序占用的内存
-    koopa_delete_program(program);
-    Visit(raw);
-    koopa_delete_raw_program_builder(builder);
-    cout << endl;
+  else if (string(mode) == "-obj")
+  {
+    // 自己编码指令, 直接写出 ELF32 可重定位目标文件, 不需要再调用汇编器
+    RVProgram program;
+    {
+      PhaseTimer timer("lower");
+      program = FinishRISCV();
+    }
+    {
+      PhaseTimer timer("emit");
+      ofstream file(output, ios::binary);
+      file << WriteELF(program);
+      if (!file)
+      {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+      }
+    }
+    pass_manager.Report();
+    ReportPhaseTimes();
     return 0;
   }
+  else if (string(mode) == "-interp")
+  {
+    // 直接解释执行, 输出文件里记录 main 的返回值和执行的指令数
+    // 编译器自身的退出码和运行程序时一样, 是返回值的低 8 位
+    if (!koopa_in)
+      raw = BuildRawProgram(ast, builder);
+    int32_t ret;
+    {
+      PhaseTimer timer("interp");
+      interp_profile = !profile_generate.empty();
+      ret = Interpret(raw);
+    }
+    if (!profile_generate.empty() && !InterpWriteProfile(profile_generate))
+    {
+      cerr << "Cannot write profile " << profile_generate << endl;
+      return 1;
+    }
+    koopa_delete_raw_program_builder(builder);
+    freopen(output, "w", stdout);
+    cout << "ret " << ret << endl;
+    cout << "insts " << interp_inst_count << endl;
+    pass_manager.Report();
+    ReportPhaseTimes();
+    return ret & 0xff;
+  }
+  else if (string(mode) == "-sim")
+  {
+    // 生成汇编后在 RV32IM 模拟器上运行, 输出文件里记录每个函数执行的指令数和周期数
+    RVProgram program;
+    {
+      PhaseTimer timer("lower");
+      program = FinishRISCV();
+    }
+    RVSimResult result;
+    {
+      PhaseTimer timer("sim");
+      result = RVSimulator(program, rv_cost_model).Run();
+    }
+    freopen(output, "w", stdout);
+    cout << "ret " << result.ret << endl;
+    cout << "insts " << result.insts << endl;
+    cout << "cycles " << result.cycles << endl;
+    for (auto &func : result.funcs)
+      cout << "func " << func.name << " insts " << func.insts << " cycles " << func.cycles << endl;
+    pass_manager.Report();
+    ReportPhaseTimes();
+    return result.ret & 0xff;
+  }
   else
     cout << "Unknown mode: " << endl;
   cout << endl;
@@ -5,6 +5,9 @@
   #include <cstring>
   #include <vector>
   #include <map>
+
+  // flex 可重入 scanner 的状态, 和 sysy.lex.cpp 里的定义相同
+  typedef void *yyscan_t;
 }
 
 %{
@@ -17,19 +20,28 @@
 #include <vector>
 #include <map>
 
-// 声明 lexer 函数和错误处理函数
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
 %}
 
+// 声明 lexer 函数和错误处理函数, 它们要用到 YYSTYPE, 所以放在 %code 里
+%code {
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+void yyerror(std::unique_ptr<BaseAST> &ast, yyscan_t scanner, const char *s);
+char *yyget_text(yyscan_t scanner);
+int yyget_lineno(yyscan_t scanner);
+}
+
 // 定义 parser 函数和错误处理函数的附加参数
 // 我们需要返回一个字符串作为 AST, 所以我们把附加参数定义成字符串的智能指针
 // 解析完成后, 我们要手动修改这个参数, 把它设置成解析得到的字符串
 %parse-param { std::unique_ptr<BaseAST> &ast }
 
+// parser 和 lexer 都是可重入的: 没有全局的 yylval/yyin, lexer 的状态在 scanner 里,
+// 各自带一个 scanner 就可以在多个线程里同时解析 (见 Parse.hpp)
+%define api.pure full
+%param { yyscan_t scanner }
+
 // yylval 的定义, 我们把它定义成了一个联合体 (union)
 // 因为 token 的值有的是字符串指针, 有的是整数
 // 之前我们在 lexer 中用到的 str_val 和 int_val 就是在这里被定义的
@@ -44,13 +56,15 @@ using namespace std;
 
 // lexer 返回的所有 token 种类的声明
 // 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
-%token INT RETURN CONST
+%token INT VOID RETURN CONST
 %token <str_val> IDENT UNARYOP MULOP ADDOP RELOP EQOP LANDOP LOROP
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
-%type <ast_val> FuncDef FuncType Block BlockItem Stmt Exp UnaryExp PrimaryExp
+%type <ast_val> FuncDef FuncType FuncFParam Block BlockItem Stmt Exp UnaryExp PrimaryExp
 %type <ast_val> AddExp MulExp RelExp EqExp LAndExp LOrExp
+%type <ast_val> Decl ConstDecl BType ConstDef ConstInitVal ConstExp VarDecl VarDef InitVal LVal
+%type <mul_val> FuncDefList FuncFParams FuncRParams BlockItemList ConstDefList VarDefList
 %type <int_val> Number
 
 %%
@@ -61,15 +75,36 @@ using namespace std;
 // 此时我们应该把 FuncDef 返回的结果收集起来, 作为 AST 传给调用 parser 的函数
 // $1 指代规则里第一个符号的返回值, 也就是 FuncDef 的返回值
 CompUnit
-  : FuncDef {
+  : FuncDefList {
     auto comp_unit = make_unique<CompUnitAST>();
-    comp_unit->func_def = unique_ptr<BaseAST>($1);
+    comp_unit->func_defs = move(*unique_ptr<MulVecType>($1));
     ast = move(comp_unit);
   }
   ;
 
+// CompUnit ::= FuncDef {FuncDef}
+// 设置了 top_level_handler 时, 每个函数一解析完就交出去编译, 列表里不保留 (见 AST.hpp)
+FuncDefList
+  : FuncDef {
+    auto func_def_list = new MulVecType();
+    if (top_level_handler)
+      top_level_handler(unique_ptr<BaseAST>($1));
+    else
+      func_def_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = func_def_list;
+  }
+  | FuncDefList FuncDef {
+    auto func_def_list = $1;
+    if (top_level_handler)
+      top_level_handler(unique_ptr<BaseAST>($2));
+    else
+      func_def_list->push_back(unique_ptr<BaseAST>($2));
+    $$ = func_def_list;
+  }
+  ;
+
 
-// FuncDef ::= FuncType IDENT '(' ')' Block;
+// FuncDef ::= FuncType IDENT '(' [FuncFParams] ')' Block;
 // 我们这里可以直接写 '(' 和 ')', 因为之前在 lexer 里已经处理了单个字符的情况
 // 解析完成后, 把这些符号的结果收集起来, 然后拼成一个新的字符串, 作为结果返回
 // $$ 表示非终结符的返回值, 我们可以通过给这个符号赋值的方法来返回结果
@@ -84,9 +119,19 @@ FuncDef
     auto funcD_ast = new FuncDefAST();
     funcD_ast->func_type = unique_ptr<BaseAST>($1);
     funcD_ast->ident = *unique_ptr<string>($2);
+    InternSymbol(funcD_ast->sym, funcD_ast->ident);
     funcD_ast->block = unique_ptr<BaseAST>($5);
     $$ = funcD_ast;
   }
+  | FuncType IDENT '(' FuncFParams ')' Block {
+    auto funcD_ast = new FuncDefAST();
+    funcD_ast->func_type = unique_ptr<BaseAST>($1);
+    funcD_ast->ident = *unique_ptr<string>($2);
+    InternSymbol(funcD_ast->sym, funcD_ast->ident);
+    funcD_ast->params = move(*unique_ptr<MulVecType>($4));
+    funcD_ast->block = unique_ptr<BaseAST>($6);
+    $$ = funcD_ast;
+  }
   ;
 
 // 同上, 不再解释
@@ -96,27 +141,58 @@ FuncType
     funcT_ast -> funcT_name = "int";
     $$ = funcT_ast;
   }
+  | VOID {
+    auto funcT_ast = new FuncTypeAST();
+    funcT_ast -> funcT_name = "void";
+    $$ = funcT_ast;
+  }
+  ;
+
+FuncFParams
+  : FuncFParam {
+    auto param_list = new MulVecType();
+    param_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = param_list;
+  }
+  | FuncFParams ',' FuncFParam {
+    auto param_list = $1;
+    param_list->push_back(unique_ptr<BaseAST>($3));
+    $$ = param_list;
+  }
+  ;
+
+FuncFParam
+  : BType IDENT {
+    auto param_ast = new FuncFParamAST();
+    param_ast->btype = unique_ptr<BaseAST>($1);
+    param_ast->ident = *unique_ptr<string>($2);
+    InternSymbol(param_ast->sym, param_ast->ident);
+    $$ = param_ast;
+  }
   ;
 // 实际上语法解释器不支持用大括号来表示重复出现，所以我们需要用递归来表示
 Block
   : '{' BlockItemList '}' {
     auto block_ast = new BlockAST();
-    block_ast->stmt = unique_ptr<BaseAST>($2);
+    block_ast->block_items = move(*unique_ptr<MulVecType>($2));
     $$ = block_ast;
   }
+  | '{' '}' {
+    $$ = new BlockAST();
+  }
   ;
 
+// 左递归收集到同一个 vector 里, 避免长列表生成很深的 AST
 BlockItemList
   : BlockItem {
-    auto block_item_list_ast = new BlockItemListAST();
-    block_item_list_ast->block_item = unique_ptr<BaseAST>($1);
-    $$ = block_item_list_ast;
+    auto block_item_list = new MulVecType();
+    block_item_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = block_item_list;
   }
   | BlockItemList BlockItem {
-    auto block_item_list_ast = new BlockItemListAST();
-    block_item_list_ast->block_item_list = unique_ptr<BaseAST>($1);
-    block_item_list_ast->block_item = unique_ptr<BaseAST>($2);
-    $$ = block_item_list_ast;
+    auto block_item_list = $1;
+    block_item_list->push_back(unique_ptr<BaseAST>($2));
+    $$ = block_item_list;
   }
   ;
 
@@ -152,22 +228,21 @@ ConstDecl
   : CONST BType ConstDefList ';' {
     auto const_decl_ast = new ConstDeclAST();
     const_decl_ast->btype = unique_ptr<BaseAST>($2);
-    const_decl_ast->const_def_list = unique_ptr<BaseAST>($3);
+    const_decl_ast->const_defs = move(*unique_ptr<MulVecType>($3));
     $$ = const_decl_ast;
   }
   ;
 
 ConstDefList
   : ConstDef {
-    auto const_def_list_ast = new ConstDefListAST();
-    const_def_list_ast->const_def = unique_ptr<BaseAST>($1);
-    $$ = const_def_list_ast;
+    auto const_def_list = new MulVecType();
+    const_def_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = const_def_list;
   }
   | ConstDefList ',' ConstDef {
-    auto const_def_list_ast = new ConstDefListAST();
-    const_def_list_ast->const_def_list = unique_ptr<BaseAST>($1);
-    const_def_list_ast->const_def = unique_ptr<BaseAST>($2);
-    $$ = const_def_list_ast;
+    auto const_def_list = $1;
+    const_def_list->push_back(unique_ptr<BaseAST>($3));
+    $$ = const_def_list;
   }
   ;
 
@@ -183,6 +258,7 @@ ConstDef
   : IDENT '=' ConstInitVal {
     auto const_def_ast = new ConstDefAST();
     const_def_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(const_def_ast->sym, const_def_ast->ident);
     const_def_ast->const_init_val = unique_ptr<BaseAST>($3);
     $$ = const_def_ast;
   }
@@ -200,22 +276,21 @@ VarDecl
   : BType VarDefList ';' {
     auto var_decl_ast = new VarDeclAST();
     var_decl_ast->btype = unique_ptr<BaseAST>($1);
-    var_decl_ast->var_def_list = unique_ptr<BaseAST>($2);
+    var_decl_ast->var_defs = move(*unique_ptr<MulVecType>($2));
     $$ = var_decl_ast;
   }
   ;
 
 VarDefList
   : VarDef {
-    auto var_def_list_ast = new VarDefListAST();
-    var_def_list_ast->var_def = unique_ptr<BaseAST>($1);
-    $$ = var_def_list_ast;
+    auto var_def_list = new MulVecType();
+    var_def_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = var_def_list;
   }
   | VarDefList ',' VarDef {
-    auto var_def_list_ast = new VarDefListAST();
-    var_def_list_ast->var_def_list = unique_ptr<BaseAST>($1);
-    var_def_list_ast->var_def = unique_ptr<BaseAST>($2);
-    $$ = var_def_list_ast;
+    auto var_def_list = $1;
+    var_def_list->push_back(unique_ptr<BaseAST>($3));
+    $$ = var_def_list;
   }
   ;
 
@@ -223,11 +298,13 @@ VarDef
   : IDENT {
     auto var_def_ast = new VarDefAST();
     var_def_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(var_def_ast->sym, var_def_ast->ident);
     $$ = var_def_ast;
   }
   | IDENT '=' InitVal {
     auto var_def_ast = new VarDefAST();
     var_def_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(var_def_ast->sym, var_def_ast->ident);
     var_def_ast->init_val = unique_ptr<BaseAST>($3);
     $$ = var_def_ast;
   }
@@ -244,21 +321,46 @@ InitVal
 Stmt
   : LVal '=' Exp ';' {
     auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::lvalT;
     stmt_ast->lval = unique_ptr<BaseAST>($1);
     stmt_ast->exp = unique_ptr<BaseAST>($3);
     $$ = stmt_ast;
   } 
   | RETURN Exp ';' {
     auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::returnT;
     stmt_ast->exp = unique_ptr<BaseAST>($2);
     $$ = stmt_ast;
   }
+  | RETURN ';' {
+    auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::returnT;
+    $$ = stmt_ast;
+  }
+  | Exp ';' {
+    auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::expT;
+    stmt_ast->exp = unique_ptr<BaseAST>($1);
+    $$ = stmt_ast;
+  }
+  | ';' {
+    auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::expT;
+    $$ = stmt_ast;
+  }
+  | Block {
+    auto stmt_ast = new StmtAST();
+    stmt_ast->type = StmtExpType::blockT;
+    stmt_ast->block = unique_ptr<BaseAST>($1);
+    $$ = stmt_ast;
+  }
   ;
 
 LVal
   : IDENT {
     auto lval_ast = new LValAST();
     lval_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(lval_ast->sym, lval_ast->ident);
     $$ = lval_ast;
   }
   ;
@@ -376,6 +478,21 @@ UnaryExp
     unary_exp_ast->exp = unique_ptr<BaseAST>($1);
     $$ = unary_exp_ast;
   }
+  | IDENT '(' ')' {
+    auto unary_exp_ast = new UnaryExpAST();
+    unary_exp_ast->type = UnaryExpType::callT;
+    unary_exp_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(unary_exp_ast->sym, unary_exp_ast->ident);
+    $$ = unary_exp_ast;
+  }
+  | IDENT '(' FuncRParams ')' {
+    auto unary_exp_ast = new UnaryExpAST();
+    unary_exp_ast->type = UnaryExpType::callT;
+    unary_exp_ast->ident = *unique_ptr<string>($1);
+    InternSymbol(unary_exp_ast->sym, unary_exp_ast->ident);
+    unary_exp_ast->args = move(*unique_ptr<MulVecType>($3));
+    $$ = unary_exp_ast;
+  }
   | UNARYOP UnaryExp {
     auto unary_exp_ast = new UnaryExpAST();
     unary_exp_ast->type = UnaryExpType::unaryT;
@@ -392,6 +509,19 @@ UnaryExp
   }
   ;
 
+FuncRParams
+  : Exp {
+    auto arg_list = new MulVecType();
+    arg_list->push_back(unique_ptr<BaseAST>($1));
+    $$ = arg_list;
+  }
+  | FuncRParams ',' Exp {
+    auto arg_list = $1;
+    arg_list->push_back(unique_ptr<BaseAST>($3));
+    $$ = arg_list;
+  }
+  ;
+
 PrimaryExp
   : '(' Exp ')' {
     auto primary_exp_ast = new PrimaryExpAST();
@@ -424,9 +554,9 @@ Number
 
 // 定义错误处理函数, 其中第二个参数是错误信息
 // parser 如果发生错误 (例如输入的程序出现了语法错误), 就会调用这个函数
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s) {
-    extern int yylineno;    // defined and maintained in lex
-    extern char *yytext;    // defined and maintained in lex
+void yyerror(std::unique_ptr<BaseAST> &ast, yyscan_t scanner, const char *s) {
+    char *yytext = yyget_text(scanner);    // maintained in lex
+    int yylineno = yyget_lineno(scanner);
     int len=strlen(yytext);
     int i;
     char buf[512]={0};